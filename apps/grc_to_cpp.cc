@@ -0,0 +1,190 @@
+/* -*- c++ -*- */
+/* Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ * co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+/*!
+ * Compiles a GRC file into a C++ translation unit, to be run at build time.
+ *
+ * The generated code holds the enabled blocks of the flowgraph with all variables
+ * collapsed and all expressions replaced by their values, and defines a single
+ * function building the flowgraph:
+ *
+ *   std::unique_ptr<flowgraph::FlowGraph> <function>(const flowgraph::BuildOptions &options);
+ *
+ * Building it needs neither the XML parser nor the expression parser. The GRC file
+ * is validated first, the tool fails if the flowgraph is not valid.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <flowgraph/flowgraph.h>
+
+#include "flowgraph_impl.h"
+
+namespace po = boost::program_options;
+
+using namespace flowgraph;
+
+static std::string cpp_string(const std::string &value)
+{
+    std::ostringstream ss;
+    ss << '"';
+    for (char c : value) {
+        switch (c) {
+        case '"':  ss << "\\\""; break;
+        case '\\': ss << "\\\\"; break;
+        case '\n': ss << "\\n"; break;
+        case '\t': ss << "\\t"; break;
+        case '\r': ss << "\\r"; break;
+        default:   ss << c;
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
+/*!
+ * GRC only parameters, e.g. the position of a block in the editor, are not needed
+ * to build the flowgraph.
+ */
+static bool keep_param(const std::string &name)
+{
+    if (name == "_enabled") {
+        return true;
+    }
+    return name.empty() || (name[0] != '_' && name != "comment" && name != "alias");
+}
+
+static void write_params(std::ostream &os, const std::string &name, const BlockInfo &info)
+{
+    os << "const flowgraph::StaticParam " << name << "[] = {\n";
+    for (const auto &param : info.params) {
+        if (keep_param(param.first)) {
+            os << "    {" << cpp_string(param.first) << ", " << cpp_string(param.second) << "},\n";
+        }
+    }
+    os << "};\n\n";
+}
+
+static size_t param_count(const BlockInfo &info)
+{
+    return std::count_if(info.params.begin(), info.params.end(),
+            [](const std::pair<const std::string, std::string> &param) { return keep_param(param.first); });
+}
+
+static void write_blocks(std::ostream &os, const std::string &name, const std::vector<BlockInfo> &blocks)
+{
+    if (blocks.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        write_params(os, name + "_" + std::to_string(i) + "_params", blocks[i]);
+    }
+
+    os << "const flowgraph::StaticBlock " << name << "[] = {\n";
+    for (size_t i = 0; i < blocks.size(); i++) {
+        os << "    {" << cpp_string(blocks[i].key) << ", " << cpp_string(blocks[i].id) << ", "
+           << name << "_" << i << "_params, " << param_count(blocks[i]) << "},\n";
+    }
+    os << "};\n\n";
+}
+
+static void write_graph(std::ostream &os, const GraphInfo &graph, const std::string &source, const std::string &function)
+{
+    os << "/* Generated by grc_to_cpp from " << source << ", do not edit. */\n\n"
+       << "#include <flowgraph/flowgraph.h>\n\n"
+       << "namespace {\n\n";
+
+    write_params(os, "top_block_params", graph.top_block);
+    write_blocks(os, "variables", graph.variables);
+    write_blocks(os, "blocks", graph.blocks);
+
+    if (!graph.connections.empty()) {
+        os << "const flowgraph::StaticConnection connections[] = {\n";
+        for (const auto &con : graph.connections) {
+            os << "    {" << cpp_string(con.src_id) << ", " << con.src_key << ", "
+               << cpp_string(con.dst_id) << ", " << con.dst_key << "},\n";
+        }
+        os << "};\n\n";
+    }
+
+    os << "}\n\n"
+       << "std::unique_ptr<flowgraph::FlowGraph> " << function << "(const flowgraph::BuildOptions &options)\n"
+       << "{\n"
+       << "    const flowgraph::StaticGraph graph = {\n"
+       << "        {" << cpp_string(graph.top_block.key) << ", " << cpp_string(graph.top_block.id)
+       << ", top_block_params, " << param_count(graph.top_block) << "},\n"
+       << "        " << (graph.variables.empty() ? "nullptr" : "variables") << ", " << graph.variables.size() << ",\n"
+       << "        " << (graph.blocks.empty() ? "nullptr" : "blocks") << ", " << graph.blocks.size() << ",\n"
+       << "        " << (graph.connections.empty() ? "nullptr" : "connections") << ", " << graph.connections.size() << "\n"
+       << "    };\n"
+       << "    return flowgraph::make_flowgraph(graph, options);\n"
+       << "}\n";
+}
+
+int main(int argc, char **argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "show this help")
+        ("grc-file", po::value<std::string>(), "GRC file")
+        ("output", po::value<std::string>(), "generated C++ file")
+        ("function", po::value<std::string>(), "name of the generated function, default: make_<flowgraph id>")
+    ;
+
+    po::positional_options_description p;
+    p.add("grc-file", 1);
+    p.add("output", 1);
+    p.add("function", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || !vm.count("grc-file") || !vm.count("output")) {
+        std::cout << "Usage: grc_to_cpp <grc-file> <output> [function]\n" << desc << "\n";
+        return vm.count("help") ? 0 : 1;
+    }
+
+    auto path = vm["grc-file"].as<std::string>();
+
+    try {
+        std::ifstream input(path);
+        if (!input) {
+            std::cerr << "can't open " << path << "\n";
+            return 1;
+        }
+
+        GrcParser parser(input);
+        parser.parse();
+        parser.collapse_variables();
+        auto graph = parser.graph();
+
+        auto errors = validate_graph(graph, BuildOptions());
+        if (!errors.empty()) {
+            for (const auto &error : errors) {
+                std::cerr << path << ": " << (error.block_id.empty() ? "" : error.block_id + ": ") << error.message << "\n";
+            }
+            return 1;
+        }
+
+        auto function = vm.count("function") ? vm["function"].as<std::string>() : "make_" + graph.top_block.id;
+
+        std::ofstream output(vm["output"].as<std::string>());
+        write_graph(output, fold_constants(graph), path, function);
+        if (!output) {
+            std::cerr << "can't write " << vm["output"].as<std::string>() << "\n";
+            return 1;
+        }
+    }
+    catch (const std::exception &e) {
+        std::cerr << path << ": " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
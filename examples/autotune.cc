@@ -0,0 +1,252 @@
+/* -*- c++ -*- */
+/* Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ * co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+/*!
+ * Empirical tuning of output buffers and chunk sizes, based on factory_example.
+ *
+ * The flowgraph is run once to find the hot edges, i.e. the output ports moving
+ * the most bytes per second, and once more to measure the baseline including the
+ * latency on these edges. Then, one producing block after the other, a grid
+ * of max_noutput_items and output buffer sizes is tried, keeping the best value
+ * of the blocks tuned before. Every trial runs the flowgraph for the given time
+ * and measures the items consumed by the sinks per second and the latency, the
+ * items queued on the hot edges divided by their rate. The best settings are
+ * written as a tuning overlay, see BuildOptions::overlay_file.
+ *
+ * Digitizers need hardware, tune a copy of the GRC file where they are replaced
+ * by a signal source or a file source with a recording and a throttle running at
+ * the digitizer sample rate.
+ */
+
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <boost/program_options.hpp>
+#include <flowgraph/flowgraph.h>
+#include <gnuradio/block_detail.h>
+
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+struct Setting
+{
+	int max_noutput_items; // 0 leaves the default
+	int buffer;            // output buffer in items, 0 leaves the default
+	size_t item_size;      // of the tuned output port
+};
+
+struct Measurement
+{
+	double throughput;     // items per second consumed by the sinks
+	double latency;        // seconds, worst hot edge
+};
+
+struct HotEdge
+{
+	flowgraph::Edge edge;
+	double bytes_per_second;
+};
+
+static void write_overlay(const std::string &path, const std::map<std::string, Setting> &settings,
+		const std::string &comment)
+{
+	std::ofstream overlay(path);
+	if (!comment.empty()) {
+		overlay << "; " << comment << "\n";
+	}
+	for (const auto &entry : settings) {
+		if (!entry.second.max_noutput_items && !entry.second.buffer) {
+			continue;
+		}
+		overlay << "\n[id:" << entry.first << "]\n";
+		if (entry.second.max_noutput_items) {
+			overlay << "max_noutput_items = " << entry.second.max_noutput_items << "\n";
+		}
+		auto buffer = flowgraph::output_buffer_setting(entry.second.buffer, entry.second.item_size);
+		if (buffer.minoutbuf) {
+			overlay << "minoutbuf = " << buffer.minoutbuf << "\n";
+		}
+		if (buffer.maxoutbuf) {
+			overlay << "maxoutbuf = " << buffer.maxoutbuf << "\n";
+		}
+	}
+}
+
+/*!
+ * Runs the flowgraph with the given settings. Fills hot_edges with the busiest edges if it is empty.
+ */
+static Measurement measure(const std::string &path, const std::map<std::string, Setting> &settings,
+		const std::string &overlay_path, int duration, size_t hot, std::vector<HotEdge> &hot_edges)
+{
+	write_overlay(overlay_path, settings, "");
+
+	std::ifstream input(path);
+	flowgraph::BuildOptions options;
+	options.overlay_file = overlay_path;
+	auto graph = flowgraph::make_flowgraph(input, options);
+	const auto &topology = graph->topology();
+
+	std::set<std::string> sinks;
+	for (const auto &edge : topology.edges()) {
+		if (topology.edges_from(edge.dst_id).empty()) {
+			sinks.insert(edge.dst_id);
+		}
+	}
+
+	graph->start();
+	auto begin = std::chrono::steady_clock::now();
+	auto end = begin + std::chrono::seconds(duration);
+
+	// items queued on the hot edges, sampled while running
+	std::vector<double> backlog(hot_edges.size(), 0.0);
+	size_t samples = 0;
+	while (std::chrono::steady_clock::now() < end) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		for (size_t i = 0; i < hot_edges.size(); i++) {
+			const auto &edge = hot_edges[i].edge;
+			auto src = graph->get_block<gr::block>(edge.src_id);
+			auto dst = graph->get_block<gr::block>(edge.dst_id);
+			if (src && dst) {
+				backlog[i] += double(src->nitems_written(edge.src_port)) - double(dst->nitems_read(edge.dst_port));
+			}
+		}
+		samples++;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	Measurement result = {0.0, 0.0};
+	for (const auto &id : sinks) {
+		auto block = graph->get_block<gr::block>(id);
+		if (block) {
+			for (int port = 0; port < block->detail()->ninputs(); port++) {
+				result.throughput += block->nitems_read(port) / elapsed;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < hot_edges.size(); i++) {
+		auto src = graph->get_block<gr::block>(hot_edges[i].edge.src_id);
+		double rate = src ? src->nitems_written(hot_edges[i].edge.src_port) / elapsed : 0.0;
+		if (rate > 0 && samples) {
+			result.latency = std::max(result.latency, backlog[i] / samples / rate);
+		}
+	}
+
+	if (hot_edges.empty()) {
+		for (const auto &edge : topology.edges()) {
+			auto src = graph->get_block<gr::block>(edge.src_id);
+			if (src) {
+				HotEdge hot_edge = {edge, src->nitems_written(edge.src_port) * edge.item_size / elapsed};
+				hot_edges.push_back(hot_edge);
+			}
+		}
+		std::sort(hot_edges.begin(), hot_edges.end(),
+				[](const HotEdge &a, const HotEdge &b) { return a.bytes_per_second > b.bytes_per_second; });
+		if (hot_edges.size() > hot) {
+			hot_edges.resize(hot);
+		}
+	}
+
+	graph->stop();
+	graph->wait();
+	return result;
+}
+
+/*!
+ * Higher throughput wins, within 2% the lower latency, trials above the latency limit lose.
+ */
+static bool better(const Measurement &a, const Measurement &b, double max_latency)
+{
+	bool a_ok = max_latency <= 0 || a.latency <= max_latency;
+	bool b_ok = max_latency <= 0 || b.latency <= max_latency;
+	if (a_ok != b_ok) {
+		return a_ok;
+	}
+	if (std::abs(a.throughput - b.throughput) <= 0.02 * std::max(a.throughput, b.throughput)) {
+		return a.latency < b.latency;
+	}
+	return a.throughput > b.throughput;
+}
+
+int main(int argc, char **argv)
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("grc-file", po::value<std::string>()->default_value("example.grc"), "GRC file")
+		("overlay", po::value<std::string>()->default_value("tuning.ini"), "tuning overlay to write")
+		("duration", po::value<int>()->default_value(5), "seconds per trial")
+		("hot-edges", po::value<size_t>()->default_value(3), "number of busiest edges to tune")
+		("max-latency", po::value<double>()->default_value(0), "latency limit in seconds, 0 for none")
+	;
+
+	po::positional_options_description p;
+	p.add("grc-file", 1);
+	p.add("overlay", 1);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+	po::notify(vm);
+
+	std::string path = vm["grc-file"].as<std::string>();
+	int duration = vm["duration"].as<int>();
+	double max_latency = vm["max-latency"].as<double>();
+
+	std::cout << "Using GRC file: " <<  path << "\n";
+
+	char trial_overlay[] = "/tmp/flowgraph_autotune_XXXXXX";
+	int fd = mkstemp(trial_overlay);
+	if (fd < 0) {
+		std::cerr << "can't create a temporary overlay\n";
+		return 1;
+	}
+	close(fd);
+
+	std::map<std::string, Setting> settings;
+	std::vector<HotEdge> hot_edges;
+	measure(path, settings, trial_overlay, duration, vm["hot-edges"].as<size_t>(), hot_edges);
+
+	// the latency is only measured once the hot edges are known
+	auto best = measure(path, settings, trial_overlay, duration, 0, hot_edges);
+	std::cout << "Baseline: " << best.throughput << " items/s, latency " << best.latency << " s\n";
+
+	const int chunks[] = {0, 512, 4096, 32768};
+	const int buffers[] = {0, 8192, 65536};
+
+	for (const auto &hot_edge : hot_edges) {
+		const auto &id = hot_edge.edge.src_id;
+		if (settings.count(id)) {
+			continue;
+		}
+		std::cout << "Tuning " << id << " (" << hot_edge.bytes_per_second << " B/s)\n";
+
+		Setting best_setting = {0, 0, hot_edge.edge.item_size};
+		for (int chunk : chunks) {
+			for (int buffer : buffers) {
+				settings[id] = Setting{chunk, buffer, hot_edge.edge.item_size};
+				auto result = measure(path, settings, trial_overlay, duration, 0, hot_edges);
+				std::cout << "  max_noutput_items " << chunk << ", buffer " << buffer << ": "
+				          << result.throughput << " items/s, latency " << result.latency << " s\n";
+				if (better(result, best, max_latency)) {
+					best = result;
+					best_setting = settings[id];
+				}
+			}
+		}
+		settings[id] = best_setting;
+	}
+
+	std::remove(trial_overlay);
+
+	std::ostringstream comment;
+	comment << "autotuned for " << path << ": " << best.throughput << " items/s, latency " << best.latency << " s";
+	write_overlay(vm["overlay"].as<std::string>(), settings, comment.str());
+	std::cout << "Best settings written to " << vm["overlay"].as<std::string>() << "\n";
+
+	return 0;
+}
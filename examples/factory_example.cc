@@ -22,6 +22,7 @@ int main(int argc, char **argv)
 	po::options_description desc("Allowed options");
 	desc.add_options()
 		("grc-file", po::value<std::string>()->default_value("example.grc"), "GRC file")
+		("overlay", po::value<std::string>(), "tuning overlay, e.g. written by autotune")
 	;
 
 	po::positional_options_description p;
@@ -35,8 +36,14 @@ int main(int argc, char **argv)
 
 	std::cout << "Using GRC file: " <<  path << "\n";
 
+	flowgraph::BuildOptions options;
+	if (vm.count("overlay")) {
+		options.overlay_file = vm["overlay"].as<std::string>();
+		std::cout << "Using tuning overlay: " << options.overlay_file << "\n";
+	}
+
 	std::ifstream input(path);
-	auto graph = flowgraph::make_flowgraph(input);
+	auto graph = flowgraph::make_flowgraph(input, options);
 
 	graph->start();
 	std::cout << "Graph started, sleep for 10 seconds...\n";
@@ -0,0 +1,131 @@
+/* -*- c++ -*- */
+/* Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ * co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+/*!
+ * Runs the same flowgraph on the thread-per-block (TPB) and the single-threaded (STS)
+ * scheduler and compares threads, CPU time, context switches and the number of
+ * items consumed by the sinks.
+ *
+ * GNU Radio chooses the scheduler once per process, so every run happens in a
+ * child process of its own.
+ */
+
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <boost/program_options.hpp>
+#include <flowgraph/flowgraph.h>
+#include <gnuradio/block_detail.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace po = boost::program_options;
+
+static double seconds(const timeval &tv)
+{
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static int run(const std::string &path, const std::string &scheduler, int duration)
+{
+	std::ifstream input(path);
+	flowgraph::BuildOptions options;
+	options.scheduler = scheduler;
+	auto graph = flowgraph::make_flowgraph(input, options);
+
+	// blocks without outputs
+	std::set<std::string> sinks;
+	for (const auto &edge : graph->topology().edges()) {
+		if (graph->topology().edges_from(edge.dst_id).empty()) {
+			sinks.insert(edge.dst_id);
+		}
+	}
+
+	rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+
+	graph->start();
+	auto threads = graph->build_report().threads;
+	std::this_thread::sleep_for(std::chrono::seconds(duration));
+
+	uint64_t items = 0;
+	for (const auto &id : sinks) {
+		auto block = graph->get_block<gr::block>(id);
+		if (block) {
+			for (int port = 0; port < block->detail()->ninputs(); port++) {
+				items += block->nitems_read(port);
+			}
+		}
+	}
+
+	graph->stop();
+	graph->wait();
+	getrusage(RUSAGE_SELF, &after);
+
+	auto cpu = seconds(after.ru_utime) + seconds(after.ru_stime) - seconds(before.ru_utime) - seconds(before.ru_stime);
+	auto voluntary = after.ru_nvcsw - before.ru_nvcsw;
+	auto involuntary = after.ru_nivcsw - before.ru_nivcsw;
+
+	std::cout << std::setw(4) << graph->build_report().scheduler
+	          << std::setw(9) << threads
+	          << std::setw(10) << std::fixed << std::setprecision(2) << cpu
+	          << std::setw(14) << voluntary
+	          << std::setw(14) << involuntary
+	          << std::setw(16) << std::setprecision(0) << items / double(duration) << "\n";
+	// the child leaves with _exit, which does not flush
+	std::cout.flush();
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("grc-file", po::value<std::string>()->default_value("example_big.grc"), "GRC file")
+		("duration", po::value<int>()->default_value(10), "seconds per scheduler")
+	;
+
+	po::positional_options_description p;
+	p.add("grc-file", 1);
+	p.add("duration", 1);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+	po::notify(vm);
+
+	std::string path = vm["grc-file"].as<std::string>();
+	int duration = vm["duration"].as<int>();
+
+	std::cout << "Using GRC file: " <<  path << ", " << duration << " s per scheduler\n\n"
+	          << "sch  threads   cpu [s]  voluntary cs  involunt. cs   sink items/s\n";
+	std::cout.flush();
+
+	int status = 0;
+	for (const std::string scheduler : {"TPB", "STS"}) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			try {
+				_exit(run(path, scheduler, duration));
+			}
+			catch (const std::exception &e) {
+				std::cerr << scheduler << ": " << e.what() << "\n";
+				std::cout.flush();
+				std::cerr.flush();
+				_exit(1);
+			}
+		}
+
+		int child_status = 1;
+		if (pid < 0 || waitpid(pid, &child_status, 0) < 0 || child_status != 0) {
+			status = 1;
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,39 @@
+/* -*- c++ -*- */
+/* Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ * co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+/*!
+ * Runs example.grc compiled to C++ by grc_to_cpp at build time, see
+ * examples/CMakeLists.txt. No GRC file is read at runtime.
+ */
+
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <flowgraph/flowgraph.h>
+
+// generated by grc_to_cpp, see example_graph.cc in the build directory
+std::unique_ptr<flowgraph::FlowGraph> make_example_graph(const flowgraph::BuildOptions &options);
+
+int main(int argc, char **argv)
+{
+	auto begin = std::chrono::steady_clock::now();
+	auto graph = make_example_graph(flowgraph::BuildOptions());
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Graph built in " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << " us\n";
+
+	graph->start();
+	std::cout << "Graph started, sleep for 10 seconds...\n";
+
+	std::this_thread::sleep_for(std::chrono::seconds(10));
+
+	graph->stop();
+	std::cout << "Stop requested, waiting...\n";
+
+	graph->wait();
+	std::cout << "Stopped.\n";
+
+	return 0;
+}
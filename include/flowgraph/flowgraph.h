@@ -12,6 +12,9 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <map>
+#include <set>
+#include <deque>
 
 #include <gnuradio/types.h>
 #include <gnuradio/runtime_types.h>
@@ -57,6 +60,7 @@ static const std::string blocks_complex_to_float_key      = "blocks_complex_to_f
 static const std::string blocks_float_to_complex_key      = "blocks_float_to_complex";
 static const std::string blocks_null_sink_key             = "blocks_null_sink";
 static const std::string blocks_null_source_key           = "blocks_null_source";
+static const std::string blocks_copy_key                  = "blocks_copy";
 static const std::string blocks_uchar_to_float_key        = "blocks_uchar_to_float";
 static const std::string blocks_vector_to_stream_key      = "blocks_vector_to_stream";
 static const std::string blocks_stream_to_vector_key      = "blocks_stream_to_vector";
@@ -104,19 +108,711 @@ static const std::vector<std::string> digitizer_keys =
         picoscope_6000_key
 };
 
+/*!
+ * \brief Graph-wide assignment of CPUs to blocks without an explicit affinity.
+ */
+enum class PinningPolicy
+{
+    NONE,         // leave it to the operating system
+    CHAIN,        // one CPU per block, neighbours along the data path on neighbouring CPUs
+    ROUND_ROBIN,  // one CPU per block, in the order of the GRC file
+    SHARED_CACHE  // connected blocks share the CPUs of one last level cache
+};
+
+/*!
+ * \brief Configuration of the load shedding of a running flowgraph.
+ *
+ * Blocks with a shed_order parameter above 0 get a branch valve. Under load
+ * the valves of the blocks with the lowest shed_order are opened only one
+ * cycle out of 2, then out of 4, then closed, before the blocks of the next
+ * shed_order are degraded. Once the load drops, the steps are undone in reverse.
+ * Blocks without shed_order, e.g. the interlock path, are never degraded.
+ */
+struct LoadShedding
+{
+    bool enabled = false;
+
+    double interval = 1.0;              // seconds between two shedding decisions
+    double cycle = 0.1;                 // seconds a degraded valve stays open or closed
+
+    double shed_cpu = 0.9;              // host CPU load shedding one more step
+    double restore_cpu = 0.7;           // host CPU load undoing one step
+    double shed_backpressure = 0.9;     // fill of the source output buffers shedding one more step
+    double restore_backpressure = 0.5;  // fill undoing one step
+};
+
+/*!
+ * \brief Options controlling how make_flowgraph builds a flowgraph.
+ */
+struct BuildOptions
+{
+    /*!
+     * Compute output buffer sizes from the propagated sample rate and the needs
+     * of the downstream blocks. Blocks with minoutbuf or maxoutbuf set in the
+     * GRC file keep their explicit values.
+     */
+    bool auto_buffer_sizing = false;
+
+    /*!
+     * Time span in seconds an automatically sized output buffer should hold.
+     * Also the latency digitizer streaming is planned for, see DigitizerPlan.
+     */
+    double target_latency = 0.01;
+
+    /*!
+     * Upper limit in bytes for the estimated memory of the flowgraph, 0 means
+     * no limit. Flowgraphs exceeding the limit are rejected before any block
+     * is made.
+     */
+    size_t memory_budget = 0;
+
+    /*!
+     * Maximum number of items per work call of blocks in the low latency class,
+     * see the latency_class block parameter. Their output buffers are limited
+     * to two such chunks, or to what the readers need if that is more.
+     */
+    int low_latency_noutput_items = 1024;
+
+    /*!
+     * Maximum number of items per work call of blocks in the throughput class,
+     * 0 leaves it to FlowGraph::start.
+     */
+    int throughput_noutput_items = 0;
+
+    /*!
+     * Pins the blocks without an affinity parameter. Hierarchical blocks, e.g.
+     * cascade_sink, pass the assignment on to their internal blocks and get all
+     * CPUs under the CHAIN and ROUND_ROBIN policies.
+     */
+    PinningPolicy pinning = PinningPolicy::NONE;
+
+    /*!
+     * CPUs used by the pinning policy. If empty, the isolated CPUs are used if
+     * there are any, otherwise all online CPUs.
+     */
+    std::vector<int> pinning_cpus;
+
+    /*!
+     * Keeps each group of connected blocks on one NUMA node, spreading the groups
+     * over the nodes by the bytes per second they produce. The blocks are confined
+     * to the CPUs of their node, so that the stream buffers, touched first by the
+     * writing block, are allocated locally. On a single node machine the placement
+     * is only reported.
+     */
+    bool numa_placement = false;
+
+    /*!
+     * GNU Radio scheduler, "TPB" (a thread per block) or "STS" (a single thread
+     * for the whole flowgraph). Takes precedence over the scheduler parameter of
+     * the GRC options block; if neither is set, GR_SCHEDULER or TPB is used.
+     *
+     * GNU Radio chooses the scheduler once per process, when the first flowgraph
+     * is started, all flowgraphs started later run on the same one. Flowgraphs
+     * needing different schedulers have to run in different processes, see
+     * BuildReport::scheduler for the scheduler actually used.
+     */
+    std::string scheduler;
+
+    /*!
+     * Host specific tuning applied on top of the GRC file before the blocks are
+     * made: an INI or JSON file setting affinity, minoutbuf, maxoutbuf,
+     * max_noutput_items, priority, latency_class or shed_order of blocks selected
+     * by id, key or glob, and options of the options block. Example:
+     *
+     * \code
+     * [options]
+     * scheduler = TPB
+     *
+     * [key:digitizers_picoscope_3000a]
+     * affinity = 2
+     * priority = fifo:50
+     *
+     * [glob:freq_sink_*]
+     * max_noutput_items = 65536
+     * \endcode
+     */
+    std::string overlay_file;
+
+    /*!
+     * Start the consumers before the sources: FlowGraph::start waits until the
+     * threads of all blocks run and only then arms the digitizers, including
+     * the ones in streaming mode, which are otherwise left to the application.
+     */
+    bool sequenced_start = false;
+
+    /*!
+     * Seconds FlowGraph::start watches the digitizer output buffers after the
+     * start, counting full buffers, i.e. moments the digitizers could not hand
+     * over samples, see StartupReport. 0 disables the measurement.
+     */
+    double startup_monitor = 0;
+
+    /*!
+     * Ids of blocks getting a valve, a copy block, in front of each connected
+     * input port. The valves let FlowGraph::disable_branch cut the block and
+     * everything downstream of it off at runtime, without a rebuild.
+     */
+    std::vector<std::string> branch_valves;
+
+    /*!
+     * Degrades low priority branches while the host is overloaded, see LoadShedding.
+     */
+    LoadShedding load_shedding;
+};
+
+/*!
+ * \brief Estimated memory allocated by a single block.
+ */
+struct BlockMemory
+{
+    std::string block_id;
+    std::string type;
+    size_t output_buffers; // stream buffers of all connected output ports
+    size_t sink_buffers;   // acquisition buffers of sinks, e.g. post-mortem buffers
+    size_t history;        // filter taps and history kept by the block
+
+    size_t total() const
+    {
+        return output_buffers + sink_buffers + history;
+    }
+};
+
+/*!
+ * \brief Estimated size of the stream buffer feeding one connection.
+ *
+ * All connections leaving the same output port share a single buffer.
+ */
+struct EdgeMemory
+{
+    std::string src_id;
+    int src_port;
+    std::string dst_id;
+    int dst_port;
+    size_t item_size;
+    size_t buffer_bytes;
+};
+
+/*!
+ * \brief Estimate of the memory a flowgraph allocates, see estimate_flowgraph_memory.
+ */
+struct MemoryEstimate
+{
+    std::vector<BlockMemory> blocks;
+    std::vector<EdgeMemory> edges;
+    size_t total;
+
+    MemoryEstimate() : total(0) { }
+};
+
+/*!
+ * \brief Output buffer size chosen for one output port.
+ */
+struct OutputBufferPlan
+{
+    std::string block_id;
+    int port;
+    size_t item_size;
+    double samp_rate;      // propagated sample rate of the port, 0 if unknown
+    long nitems;           // applied buffer size in items, 0 if left to GNU Radio
+    bool explicit_setting; // minoutbuf/maxoutbuf set in the GRC file
+};
+
+/*!
+ * \brief Latency class assigned to one block.
+ */
+struct LatencyPlan
+{
+    std::string block_id;
+    std::string latency_class; // "low" or "throughput"
+    bool inherited;            // not set on the block, derived from its consumers
+    int max_noutput_items;     // applied chunk size, 0 if left to the scheduler
+    long buffer_items;         // applied output buffer size, 0 if unchanged
+};
+
+/*!
+ * \brief Streaming settings chosen for one digitizer.
+ *
+ * buff_size and poll_rate set to "auto", "0" or left empty in the GRC file are
+ * planned from the output rate and BuildOptions::target_latency. In that case
+ * also minoutbuf, unless set. Explicit values are kept.
+ */
+struct DigitizerPlan
+{
+    std::string block_id;
+    int channels;            // enabled analog channels
+    double output_rate;      // samples per second and channel after downsampling
+    int buff_size;           // driver buffer in samples per channel
+    double poll_rate;        // polling period in seconds
+    long minoutbuf;          // output buffer of each port in items, 0 if left to GNU Radio
+    bool buff_size_planned;
+    bool poll_rate_planned;
+    bool minoutbuf_planned;
+};
+
+/*!
+ * \brief Scheduling of the thread of one block, see the priority block parameter.
+ */
+struct ThreadPriority
+{
+    enum Policy { FIFO, RR, NICE };
+
+    Policy policy;
+    int value; // realtime priority for FIFO and RR, nice value for NICE
+};
+
+/*!
+ * \brief Outcome of applying the priority of one block when the flowgraph was started.
+ */
+struct PriorityResult
+{
+    std::string block_id;
+    std::string requested; // e.g. "fifo:50"
+    bool applied;
+    std::string message;   // reason if not applied
+};
+
+/*!
+ * \brief Outcome of FlowGraph::pause or FlowGraph::resume.
+ */
+struct PauseReport
+{
+    double duration;                       // seconds spent in the call
+    std::vector<std::string> digitizers;   // disarmed by pause, re-armed by resume
+    std::vector<std::string> free_running; // sources which can't be paused, e.g. signal sources
+
+    PauseReport() : duration(0.0) { }
+};
+
+/*!
+ * \brief Outcome of FlowGraph::drain.
+ */
+struct DrainReport
+{
+    bool complete;                         // all buffers emptied before the timeout
+    double duration;                       // seconds from disarming to stopped
+    uint64_t flushed_items;                // digitizer output items consumed after the digitizers were
+                                           // disarmed, counted once, not again by every later stage
+    std::vector<std::string> free_running; // sources which can't be stopped, their paths are not drained
+
+    DrainReport() : complete(false), duration(0.0), flushed_items(0) { }
+};
+
+/*!
+ * \brief Time spent in the phases of FlowGraph::stop_for and FlowGraph::teardown, in seconds.
+ */
+struct TeardownReport
+{
+    bool complete;                    // all block threads exited before the timeout
+    double stop_duration;             // interrupting the block threads
+    double exit_duration;             // until the block threads exited
+    double wait_duration;             // joining the block threads
+    double disconnect_duration;       // teardown only
+    double destroy_duration;          // teardown only, releasing the blocks in parallel
+    std::vector<std::string> running; // blocks whose threads had not exited at the timeout, internal
+                                      // blocks of hierarchical blocks by their alias
+
+    TeardownReport() :
+        complete(false),
+        stop_duration(0.0),
+        exit_duration(0.0),
+        wait_duration(0.0),
+        disconnect_duration(0.0),
+        destroy_duration(0.0)
+    {
+    }
+};
+
+/*!
+ * \brief Outcome of the last FlowGraph::start.
+ */
+struct StartupReport
+{
+    double ready_duration;               // seconds until all block threads ran, sequenced start only
+    double arm_duration;                 // seconds spent arming the digitizers, sequenced start only
+    std::vector<std::string> armed;      // digitizers armed by the sequenced start
+    int samples;                         // checks of the digitizer buffers, see BuildOptions::startup_monitor
+    int full_buffer_events;              // checks finding a digitizer output buffer full
+
+    StartupReport() : ready_duration(0.0), arm_duration(0.0), samples(0), full_buffer_events(0) { }
+};
+
+/*!
+ * \brief Outcome of FlowGraph::start_group.
+ */
+struct GroupStartReport
+{
+    struct Arming
+    {
+        size_t graph;        // index in the list passed to start_group
+        std::string block_id;
+        double offset;       // seconds from the barrier release until arm() returned
+    };
+
+    double prepare_duration;             // seconds until the threads of all blocks ran
+    double skew;                         // seconds between the first and the last digitizer armed
+    std::vector<Arming> armed;
+    std::vector<std::string> unsynchronized; // "<graph index>:<block id>", armed by the start itself
+
+    GroupStartReport() : prepare_duration(0.0), skew(0.0) { }
+};
+
+/*!
+ * \brief A change of the valve of one block taken by the load shedding.
+ */
+struct SheddingAction
+{
+    double time;          // seconds since the flowgraph was started
+    std::string block_id;
+    int divisor;          // valve open one cycle out of divisor, 0 closed
+    double cpu;           // host CPU load which triggered the action
+    double backpressure;  // fill of the fullest source output buffer
+};
+
+/*!
+ * \brief State and history of the load shedding, see FlowGraph::load_shedding_report.
+ */
+struct LoadSheddingReport
+{
+    size_t step;                            // current step, 0 if nothing is shed
+    size_t max_step;
+    size_t sheds;                           // steps taken under load
+    size_t restores;                        // steps undone
+    double cpu;                             // last measurement
+    double backpressure;
+    std::map<std::string, int> divisors;    // current divisor per annotated block
+    std::map<std::string, size_t> actions;  // valve changes per block
+    std::vector<SheddingAction> log;        // latest valve changes, oldest first
+
+    LoadSheddingReport() :
+        step(0),
+        max_step(0),
+        sheds(0),
+        restores(0),
+        cpu(0.0),
+        backpressure(0.0)
+    {
+    }
+};
+
+/*!
+ * \brief Decisions taken by make_flowgraph while building the flowgraph.
+ */
+struct BuildReport
+{
+    std::vector<OutputBufferPlan> buffers;
+    std::vector<LatencyPlan> latency;
+    std::vector<DigitizerPlan> digitizers;
+    std::map<std::string, std::vector<int>> affinity; // explicit and pinned affinities
+    std::map<std::string, int> numa_node;             // with numa_placement only
+    std::vector<PriorityResult> priorities;           // updated by FlowGraph::start
+    MemoryEstimate memory;
+
+    int max_noutput_items;       // default cap used by FlowGraph::start()
+    bool realtime_requested;     // realtime_scheduling set in the options block
+    bool realtime_granted;
+    std::string realtime_status; // result of gr::enable_realtime_scheduling, set by FlowGraph::start
+    std::string scheduler_requested; // empty if not requested
+    std::string scheduler;           // scheduler of the process, set by FlowGraph::start
+    size_t threads;                  // scheduler threads of the running flowgraph
+    StartupReport startup;           // updated by FlowGraph::start
+    std::vector<std::string> adopted; // blocks taken over with their state from the previous flowgraph
+
+    BuildReport() :
+        max_noutput_items(100000000),
+        realtime_requested(false),
+        realtime_granted(false),
+        threads(0)
+    {
+    }
+};
+
+/*!
+ * \brief A block parameter of a flowgraph compiled to C++, see apps/grc_to_cpp.
+ */
+struct StaticParam
+{
+    const char *name;
+    const char *value;
+};
+
+/*!
+ * \brief A block or variable of a flowgraph compiled to C++.
+ */
+struct StaticBlock
+{
+    const char *key;
+    const char *id;
+    const StaticParam *params;
+    size_t param_count;
+};
+
+/*!
+ * \brief A connection of a flowgraph compiled to C++.
+ */
+struct StaticConnection
+{
+    const char *src_id;
+    int src_port;
+    const char *dst_id;
+    int dst_port;
+};
+
+/*!
+ * \brief A flowgraph compiled to C++ by grc_to_cpp.
+ *
+ * Contains the enabled blocks of a GRC file with all variables collapsed and
+ * all expressions replaced by their values, so that building it needs neither
+ * the XML parser nor the expression parser.
+ */
+struct StaticGraph
+{
+    StaticBlock top_block;
+    const StaticBlock *variables;
+    size_t variable_count;
+    const StaticBlock *blocks;
+    size_t block_count;
+    const StaticConnection *connections;
+    size_t connection_count;
+};
+
+/*!
+ * \brief A problem found by validate_flowgraph.
+ */
+struct ValidationError
+{
+    std::string block_id; // empty for problems not related to a single block
+    std::string message;
+};
+
+/*!
+ * \brief A connection from an output port to an input port.
+ */
+struct Edge
+{
+    std::string src_id;
+    int src_port;
+    std::string dst_id;
+    int dst_port;
+    size_t item_size;
+};
+
+/*!
+ * \brief Outcome of FlowGraph::reconnect.
+ */
+struct ReconnectReport
+{
+    Edge removed;              // replaced connection, src_id empty if the input was not connected
+    Edge added;
+    std::string null_sink;     // added to the old source port, which lost its last consumer
+    std::string removed_null_sink; // null sink of the new source port, replaced by the new consumer
+    bool running;              // changed under lock/unlock
+    double lock_duration;      // seconds from lock() until the connections were changed
+    double interruption;       // seconds from lock() until unlock() returned, all blocks stall meanwhile
+
+    ReconnectReport() : removed(), added(), running(false), lock_duration(0.0), interruption(0.0) { }
+};
+
+/*!
+ * \brief Adjacency index of the connections of a flowgraph.
+ *
+ * In all queries a negative port stands for all ports of the block.
+ */
+class Topology
+{
+public:
+    void add_edge(const Edge &edge)
+    {
+        d_edges_out[edge.src_id].push_back(edge);
+        d_edges_in[edge.dst_id].push_back(edge);
+    }
+
+    /*!
+     * \brief Removes the connection between the ports of the given edge, the
+     * item size is ignored. Returns false if there is no such connection.
+     */
+    bool remove_edge(const Edge &edge)
+    {
+        auto same_ports = [&edge](const Edge &other) {
+            return other.src_id == edge.src_id && other.src_port == edge.src_port
+                    && other.dst_id == edge.dst_id && other.dst_port == edge.dst_port;
+        };
+        bool removed = erase_edges(d_edges_out, edge.src_id, same_ports);
+        erase_edges(d_edges_in, edge.dst_id, same_ports);
+        return removed;
+    }
+
+    /*!
+     * \brief All connections, ordered by source block.
+     */
+    std::vector<Edge> edges() const
+    {
+        std::vector<Edge> all;
+        for (const auto &out : d_edges_out) {
+            all.insert(all.end(), out.second.begin(), out.second.end());
+        }
+        return all;
+    }
+
+    /*!
+     * \brief Connections leaving the given output port.
+     */
+    std::vector<Edge> edges_from(const std::string &id, int port = -1) const
+    {
+        return select(d_edges_out, id, port, true);
+    }
+
+    /*!
+     * \brief Connections arriving at the given input port.
+     */
+    std::vector<Edge> edges_to(const std::string &id, int port = -1) const
+    {
+        return select(d_edges_in, id, port, false);
+    }
+
+    /*!
+     * \brief Ids of all blocks fed, directly or indirectly, by the given output port.
+     */
+    std::vector<std::string> downstream(const std::string &id, int port = -1) const
+    {
+        return traverse(id, port, true);
+    }
+
+    /*!
+     * \brief Ids of all blocks feeding, directly or indirectly, the given input port.
+     */
+    std::vector<std::string> upstream(const std::string &id, int port = -1) const
+    {
+        return traverse(id, port, false);
+    }
+
+    /*!
+     * \brief Ids of the blocks without outputs fed by the given output port.
+     */
+    std::vector<std::string> sinks(const std::string &id, int port = -1) const
+    {
+        std::vector<std::string> result;
+        for (const auto &block : downstream(id, port)) {
+            if (!d_edges_out.count(block)) {
+                result.push_back(block);
+            }
+        }
+        return result;
+    }
+
+    /*!
+     * \brief Ids of the blocks without inputs feeding the given input port.
+     */
+    std::vector<std::string> sources(const std::string &id, int port = -1) const
+    {
+        std::vector<std::string> result;
+        for (const auto &block : upstream(id, port)) {
+            if (!d_edges_in.count(block)) {
+                result.push_back(block);
+            }
+        }
+        return result;
+    }
+
+private:
+    typedef std::map<std::string, std::vector<Edge>> EdgeIndex;
+
+    static std::vector<Edge> select(const EdgeIndex &index, const std::string &id, int port, bool by_src_port)
+    {
+        std::vector<Edge> result;
+        auto it = index.find(id);
+        if (it != index.end()) {
+            for (const auto &edge : it->second) {
+                if (port < 0 || (by_src_port ? edge.src_port : edge.dst_port) == port) {
+                    result.push_back(edge);
+                }
+            }
+        }
+        return result;
+    }
+
+    // sinks() and sources() rely on blocks without edges having no entry
+    template <class Predicate>
+    static bool erase_edges(EdgeIndex &index, const std::string &id, Predicate predicate)
+    {
+        auto it = index.find(id);
+        if (it == index.end()) {
+            return false;
+        }
+        auto &edges = it->second;
+        auto end = std::remove_if(edges.begin(), edges.end(), predicate);
+        bool found = end != edges.end();
+        edges.erase(end, edges.end());
+        if (edges.empty()) {
+            index.erase(it);
+        }
+        return found;
+    }
+
+    // breadth first, in the order blocks are reached
+    std::vector<std::string> traverse(const std::string &id, int port, bool downstream) const
+    {
+        std::vector<std::string> result;
+        std::set<std::string> visited = {id};
+        std::deque<std::string> pending;
+
+        auto visit = [&](const std::vector<Edge> &edges) {
+            for (const auto &edge : edges) {
+                const auto &next = downstream ? edge.dst_id : edge.src_id;
+                if (visited.insert(next).second) {
+                    result.push_back(next);
+                    pending.push_back(next);
+                }
+            }
+        };
+
+        visit(downstream ? edges_from(id, port) : edges_to(id, port));
+        while (!pending.empty()) {
+            auto block = pending.front();
+            pending.pop_front();
+            visit(downstream ? edges_from(block) : edges_to(block));
+        }
+
+        return result;
+    }
+
+    EdgeIndex d_edges_out;
+    EdgeIndex d_edges_in;
+};
+
+class GraphBuilder;
+class LoadSheddingController;
+
 class FlowGraph
 {
 	struct FlowGraphEntry
 	{
 		gr::basic_block_sptr block;
 		std::string type;
+		std::string signature; // see GraphBuilder, empty for blocks added by hand
+	};
+
+	struct BlockThread
+	{
+		std::string block_id;
+		unsigned long long start_time; // tells a reused kernel thread id apart, see record_thread_ids
 	};
 
+	friend class GraphBuilder;
+
 public:
 	FlowGraph(const std::string &name) :
 		d_top_block(gr::make_top_block(name)),
-		d_started(false)
+		d_started(false),
+		d_paused(false),
+		d_sequenced_start(false),
+		d_startup_monitor(0.0)
+	{
+	}
+
+	~FlowGraph()
 	{
+		stop_load_shedding();
+		release_threads();
 	}
 
 	/*!
@@ -131,7 +827,7 @@ public:
             throw std::invalid_argument(message.str());
 		}
 
-		FlowGraphEntry entry = {block, type};
+		FlowGraphEntry entry = {block, type, std::string()};
 		d_block_map[id] = entry;
 	}
 
@@ -155,8 +851,37 @@ public:
         }
 
 		d_top_block->connect(d_block_map[src].block, src_port, d_block_map[dst].block, dst_port);
+
+		// includes the vector length
+		size_t item_size = d_block_map[src].block->output_signature()->sizeof_stream_item(src_port);
+		Edge edge = {src, src_port, dst, dst_port, item_size};
+		d_topology.add_edge(edge);
+	}
+
+	/*!
+	 * \brief Returns the connections made so far, e.g. to find all sinks fed by a digitizer channel.
+	 *
+	 * Example:
+	 * \code
+	 * for (const auto &sink : graph->topology().sinks("picoscope", 0)) {
+	 *     std::cout << sink << "\n";
+	 * }
+	 * \endcode
+	 */
+	const Topology &topology() const
+	{
+		return d_topology;
 	}
 
+    /*!
+     * Start the contained flowgraph, using max_nouts of the GRC options
+     * block as maximum number of output items if set.
+     */
+    void start()
+    {
+        start(d_build_report.max_noutput_items);
+    }
+
     /*!
      * Start the contained flowgraph.
      *
@@ -166,20 +891,143 @@ public:
      * maximum. Use this to adjust the maximum latency a flowgraph can
      * exhibit.
      */
-    void start(int max_noutput_items=100000000)
+    void start(int max_noutput_items)
     {
-    	d_top_block->start(max_noutput_items);
-    	d_started = true;
+    	start_threads(max_noutput_items);
+    	sequence_start();
     }
 
+    /*!
+     * \brief Starts several flowgraphs so that their digitizers start together.
+     *
+     * All flowgraphs are started and, once the threads of all their blocks run,
+     * the digitizers of all flowgraphs are armed at once, each from a thread of
+     * its own waiting on a single barrier. The flowgraphs should be built with
+     * BuildOptions::sequenced_start, digitizers armed by the start itself are
+     * reported as not synchronized.
+     *
+     * If a flowgraph fails to start or a digitizer fails to arm, the flowgraphs
+     * started so far are stopped and the exception is rethrown.
+     */
+    FLOWGRAPH_API static GroupStartReport start_group(const std::vector<FlowGraph *> &graphs);
+
 
     /*!
      * Stop the running flowgraph.
      */
     void stop()
     {
+    	stop_load_shedding();
     	d_top_block->stop();
     	d_started = false;
+    	d_paused = false;
+    	d_paused_digitizers.clear();
+    	release_threads();
+    }
+
+    /*!
+     * \brief Stops the flowgraph, waiting at most timeout seconds for the block threads.
+     *
+     * Blocks whose threads are still inside a work call at the timeout are listed
+     * in the report and the threads are not joined, call wait() to join them later.
+     */
+    FLOWGRAPH_API TeardownReport stop_for(double timeout);
+
+    /*!
+     * \brief Stops the flowgraph like stop_for and releases all blocks.
+     *
+     * The blocks are disconnected and released from several threads in parallel,
+     * the flowgraph is empty afterwards. Nothing is released if the block threads
+     * did not exit before the timeout.
+     */
+    FLOWGRAPH_API TeardownReport teardown(double timeout);
+
+    /*!
+     * \brief Stops the running flowgraph without losing the samples in flight.
+     *
+     * The digitizers are disarmed first, then the blocks downstream of them get
+     * up to timeout seconds to consume everything buffered, before the flowgraph
+     * is stopped and waited for. Sources other than digitizers can't be stopped
+     * on their own, the blocks they feed, directly or indirectly, are not drained
+     * and stop as with stop().
+     */
+    FLOWGRAPH_API DrainReport drain(double timeout);
+
+    /*!
+     * \brief Feeds the given input port from another output port, e.g. to move a
+     * time_domain_sink to a different signal without a rebuild.
+     *
+     * A running flowgraph is changed under lock/unlock: GNU Radio stops all block
+     * threads, rewires the flowgraph keeping the buffers of unchanged connections
+     * and restarts the threads, the report holds the measured interruption. If the
+     * old source port loses its last consumer, it is terminated by a null sink,
+     * which counts against the thread budget, see set_thread_budget. A valve in
+     * front of the input port, see BuildOptions::branch_valves, stays in place.
+     * Throws std::invalid_argument for unknown blocks or different item sizes.
+     *
+     * Example:
+     * \code
+     * auto report = graph->reconnect("picoscope", 2, "time_sink", 0);
+     * std::cout << "interrupted for " << report.interruption << " s\n";
+     * \endcode
+     */
+    FLOWGRAPH_API ReconnectReport reconnect(const std::string &src, int src_port,
+            const std::string &dst, int dst_port);
+
+    /*!
+     * \brief Stops feeding the branch starting at the given block, see
+     * BuildOptions::branch_valves.
+     *
+     * The valves in front of the block drop their input, so the block and the
+     * blocks downstream of it wait for input without using CPU, while the rest
+     * of the flowgraph keeps running. Blocks downstream fed by other paths too
+     * only get the input of the other paths. Throws if the block has no valve.
+     */
+    void disable_branch(const std::string &id)
+    {
+        set_branch_enabled(id, false);
+    }
+
+    /*!
+     * \brief Feeds the branch starting at the given block again. The branch
+     * continues with the current input, the samples dropped meanwhile are lost.
+     */
+    void enable_branch(const std::string &id)
+    {
+        set_branch_enabled(id, true);
+    }
+
+    /*!
+     * \brief Whether the branch starting at the given block is fed, true for
+     * blocks without valves.
+     */
+    FLOWGRAPH_API bool branch_enabled(const std::string &id) const;
+
+    /*!
+     * \brief State and history of the load shedding, see BuildOptions::load_shedding.
+     */
+    FLOWGRAPH_API LoadSheddingReport load_shedding_report() const;
+
+    /*!
+     * \brief Idles the running flowgraph between acquisitions without stopping it.
+     *
+     * The armed digitizers are disarmed, so the blocks downstream run out of input
+     * and wait. Threads, buffers and the state of all blocks are kept. Sources other
+     * than digitizers keep running, they are listed in the returned report.
+     */
+    FLOWGRAPH_API PauseReport pause();
+
+    /*!
+     * \brief Re-arms the digitizers disarmed by pause.
+     */
+    FLOWGRAPH_API PauseReport resume();
+
+    /*!
+     * \brief Returns true between pause and resume.
+     */
+    bool is_paused() const
+    {
+        return d_paused;
     }
 
     /*!
@@ -196,6 +1044,8 @@ public:
     void wait()
     {
     	d_top_block->wait();
+    	stop_load_shedding();
+    	release_threads();
     }
 
     std::vector<gr::digitizers::signal_metadata_t> getAllChannelMetaData()
@@ -404,14 +1254,125 @@ public:
         return success;
     }
 
+    /*!
+     * \brief Returns the decisions taken while the flowgraph was built.
+     */
+    const BuildReport &build_report() const
+    {
+        return d_build_report;
+    }
+
 private:
+	/*!
+	 * Applies the priority parameters to the block threads, which only exist
+	 * once the flowgraph is started. Refusals are reported, not thrown.
+	 */
+	FLOWGRAPH_API void apply_thread_priorities();
+
+	/*!
+	 * Selects the requested scheduler if this is the first flowgraph started in
+	 * the process, otherwise reports the scheduler chosen before.
+	 */
+	FLOWGRAPH_API void select_scheduler();
+
+	/*!
+	 * Opens or closes the valves in front of the given block.
+	 */
+	FLOWGRAPH_API void set_branch_enabled(const std::string &id, bool enabled);
+
+	/*!
+	 * Starts the load shedding controller thread of the started flowgraph, if
+	 * any block is annotated.
+	 */
+	FLOWGRAPH_API void start_load_shedding();
+
+	/*!
+	 * Stops the controller thread and opens all valves it degraded.
+	 */
+	FLOWGRAPH_API void stop_load_shedding();
+
+	/*!
+	 * Starts the scheduler threads, everything start does but the sequencing.
+	 */
+	FLOWGRAPH_API void start_threads(int max_noutput_items);
+
+	/*!
+	 * Arms the digitizers once all block threads run if sequenced_start is set,
+	 * then watches the digitizer buffers for startup_monitor seconds.
+	 */
+	FLOWGRAPH_API void sequence_start();
+
+	/*!
+	 * Checks the thread budget of the process before the flowgraph is started,
+	 * see set_thread_budget. Throws if the blocks known before the start, i.e.
+	 * without the internal blocks of hierarchical blocks, do not fit.
+	 */
+	FLOWGRAPH_API void reserve_threads();
+
+	/*!
+	 * Adds the scheduler threads of the started flowgraph, see record_thread_ids,
+	 * to the threads of the process. Stops the flowgraph and throws if they
+	 * exceed the thread budget.
+	 */
+	FLOWGRAPH_API void account_threads(size_t threads);
+
+	/*!
+	 * Returns the threads of the flowgraph to the budget of the process.
+	 */
+	FLOWGRAPH_API void release_threads();
+
+	/*!
+	 * Records the kernel thread ids of the scheduler threads of the started
+	 * flowgraph, including those of the internal blocks of hierarchical blocks.
+	 * Returns the number of scheduler threads, one per flattened block or one
+	 * under STS.
+	 */
+	FLOWGRAPH_API size_t record_thread_ids();
+
 	gr::top_block_sptr d_top_block;
 	std::map<std::string, FlowGraphEntry> d_block_map;
 	bool d_started;
+	BuildReport d_build_report;
+	Topology d_topology;
+	std::map<std::string, ThreadPriority> d_priorities;
+	std::map<std::string, std::vector<std::string>> d_valves; // block id to the ids of its valves
+	std::set<std::string> d_null_sinks; // added by reconnect
+	std::map<std::string, int> d_shed_orders;
+	LoadShedding d_load_shedding;
+	std::shared_ptr<LoadSheddingController> d_shedding; // shared_ptr, the type is only known in flowgraph.cc
+	LoadSheddingReport d_last_shedding_report;
+	std::map<long, BlockThread> d_thread_ids; // by kernel thread id, see record_thread_ids
+	bool d_paused;
+	std::vector<std::string> d_paused_digitizers;
+	bool d_sequenced_start;
+	double d_startup_monitor;
 
 };
 
 
+/*!
+ * \brief Limits the scheduler threads of all flowgraphs running in the process,
+ * 0 means no limit.
+ *
+ * FlowGraph::start refuses to start a flowgraph that would exceed the budget.
+ * The thread-per-block scheduler needs a thread for every block, including the
+ * internal blocks of hierarchical blocks, the single-threaded scheduler one per
+ * flowgraph, see BuildOptions::scheduler. The internal blocks are only known
+ * once the flowgraph runs, if they exceed the budget it is stopped again and
+ * start throws.
+ */
+FLOWGRAPH_API void set_thread_budget(size_t threads);
+
+/*!
+ * \brief Current thread budget of the process, 0 if unlimited.
+ */
+FLOWGRAPH_API size_t thread_budget();
+
+/*!
+ * \brief Scheduler threads of all flowgraphs currently running in the process.
+ */
+FLOWGRAPH_API size_t scheduler_threads();
+
 /*!
  * \brief Creates a flowgraph based on input stream.
  *
@@ -426,6 +1387,103 @@ private:
  */
 std::unique_ptr<FlowGraph> FLOWGRAPH_API make_flowgraph(std::istream &input);
 
+/*!
+ * \brief Creates a flowgraph based on input stream using the given build options.
+ *
+ * Example:
+ * \code
+ * flowgraph::BuildOptions options;
+ * options.auto_buffer_sizing = true;
+ * options.target_latency = 0.005;
+ *
+ * std::ifstream input("input.grc");
+ * auto graph = make_flowgraph(input, options);
+ * \endcode
+ * \returns flowgraph (unique pointer)
+ */
+std::unique_ptr<FlowGraph> FLOWGRAPH_API make_flowgraph(std::istream &input, const BuildOptions &options);
+
+/*!
+ * \brief Rebuilds a flowgraph, carrying the state of unchanged blocks over.
+ *
+ * Stateful blocks, e.g. signal_averager, block_spectral_peaks, freq_estimator
+ * or filters, whose id and parameters did not change are taken over from the
+ * previous flowgraph as they are, so their averaging windows and filter
+ * histories stay valid. All other blocks are made anew. The previous flowgraph
+ * is stopped and left empty, its other blocks are released before any block is
+ * made, so that digitizers can be opened again. See BuildReport::adopted. The
+ * adopted blocks get the affinity, buffer and chunk settings of the new build.
+ * If the build throws, the adopted blocks are handed back to previous, which
+ * can then be rebuilt from its own GRC file with their state.
+ *
+ * Example:
+ * \code
+ * std::ifstream input("input.grc");
+ * graph = make_flowgraph(input, options, *graph);
+ * \endcode
+ * \returns flowgraph (unique pointer)
+ */
+std::unique_ptr<FlowGraph> FLOWGRAPH_API make_flowgraph(std::istream &input, const BuildOptions &options, FlowGraph &previous);
+
+/*!
+ * \brief Creates a flowgraph compiled to C++ by grc_to_cpp.
+ *
+ * Example:
+ * \code
+ * // generated by: grc_to_cpp input.grc input_graph.cc make_input_graph
+ * std::unique_ptr<flowgraph::FlowGraph> make_input_graph(const flowgraph::BuildOptions &options);
+ *
+ * auto graph = make_input_graph(flowgraph::BuildOptions());
+ * \endcode
+ * \returns flowgraph (unique pointer)
+ */
+std::unique_ptr<FlowGraph> FLOWGRAPH_API make_flowgraph(const StaticGraph &graph, const BuildOptions &options = BuildOptions());
+
+/*!
+ * \brief Estimates the memory a flowgraph will allocate, without making any block.
+ *
+ * Covers the stream buffers of all connected output ports (as sized by GNU Radio,
+ * minoutbuf/maxoutbuf or automatic buffer sizing), the acquisition buffers of the
+ * sinks and the filter history of the blocks. Item sizes and sink buffers are
+ * derived from the block parameters, the result is an estimate.
+ */
+MemoryEstimate FLOWGRAPH_API estimate_flowgraph_memory(std::istream &input, const BuildOptions &options = BuildOptions());
+
+/*!
+ * \brief Output buffer setting applying a planned size, 0 leaves the value unset.
+ *
+ * GNU Radio 3.7 allocates its default of 64 KiB or what the readers need, caps
+ * that by maxoutbuf and only raises it to minoutbuf if no maxoutbuf is set. A
+ * plan of at least the default is therefore set as minoutbuf alone, a smaller
+ * one as maxoutbuf alone.
+ */
+struct OutputBufferSetting
+{
+    long minoutbuf;
+    long maxoutbuf;
+};
+
+OutputBufferSetting FLOWGRAPH_API output_buffer_setting(long nitems, size_t item_size);
+
+/*!
+ * \brief Checks a flowgraph without making any block, so no hardware is needed.
+ *
+ * Parses the input, evaluates all block parameters, checks that all block types
+ * are supported and that connected ports exist and have the same item size, and
+ * checks the memory budget. Item sizes are only checked for blocks whose ports
+ * are known without making them, i.e. GNU Radio blocks.
+ *
+ * Example:
+ * \code
+ * std::ifstream input("input.grc");
+ * for (const auto &error : flowgraph::validate_flowgraph(input)) {
+ *     std::cerr << error.block_id << ": " << error.message << "\n";
+ * }
+ * \endcode
+ * \returns all problems found, empty if the flowgraph is valid
+ */
+std::vector<ValidationError> FLOWGRAPH_API validate_flowgraph(std::istream &input, const BuildOptions &options = BuildOptions());
+
 }
 
 
@@ -0,0 +1,192 @@
+/* -*- c++ -*- */
+/* Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ * co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+#ifndef _FLOWGRAPH_FLOWGRAPH_MANAGER_H_
+#define _FLOWGRAPH_FLOWGRAPH_MANAGER_H_
+
+#include <flowgraph/flowgraph.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace flowgraph {
+
+/*!
+ * \brief Limits shared by all flowgraphs of a FlowGraphManager.
+ */
+struct ManagerLimits
+{
+    /*!
+     * Scheduler threads of all flowgraphs in the process, 0 means no limit.
+     * Applied as the thread budget of the process, see set_thread_budget.
+     */
+    size_t threads = 0;
+
+    /*!
+     * Estimated memory in bytes of all flowgraphs, 0 means no limit. Each
+     * flowgraph is built with the memory left by the others as its
+     * BuildOptions::memory_budget.
+     */
+    size_t memory = 0;
+
+    /*!
+     * CPUs handed out to the flowgraphs, each CPU to a single flowgraph. Empty
+     * means the flowgraphs are not pinned by the manager.
+     */
+    std::vector<int> cpus;
+};
+
+/*!
+ * \brief State of one managed flowgraph.
+ */
+struct ManagedGraphMetrics
+{
+    std::string name;
+    std::string path;
+    bool running;
+    size_t threads;        // scheduler threads, 0 if not running
+    size_t memory;         // estimated bytes
+    std::vector<int> cpus; // CPUs handed out by the manager
+    size_t reloads;
+
+    ManagedGraphMetrics() : running(false), threads(0), memory(0), reloads(0) { }
+};
+
+/*!
+ * \brief Aggregated state of all flowgraphs of a FlowGraphManager.
+ */
+struct ManagerMetrics
+{
+    std::vector<ManagedGraphMetrics> graphs;
+    size_t running;
+    size_t threads;        // sum over the managed flowgraphs
+    size_t process_threads; // scheduler threads of all flowgraphs in the process
+    size_t thread_budget;
+    size_t memory;
+    size_t memory_budget;
+    std::vector<int> free_cpus;
+
+    ManagerMetrics() :
+        running(0),
+        threads(0),
+        process_threads(0),
+        thread_budget(0),
+        memory(0),
+        memory_budget(0)
+    {
+    }
+};
+
+/*!
+ * \brief Owns several flowgraphs of one process and keeps them within shared
+ * limits for threads, memory and CPUs.
+ *
+ * Flowgraphs are identified by name. Adding, reloading or removing one of them
+ * only stops that flowgraph, the others keep running. A reload checks the new
+ * GRC file before the running flowgraph is stopped, so an invalid file or one
+ * exceeding the memory left by the others leaves it running.
+ *
+ * Example:
+ * \code
+ * flowgraph::ManagerLimits limits;
+ * limits.threads = 200;
+ * limits.memory = 2ul << 30;
+ * limits.cpus = {2, 3, 4, 5, 6, 7};
+ *
+ * flowgraph::FlowGraphManager manager(limits);
+ * manager.add("ring", "ring.grc", flowgraph::BuildOptions(), 4);
+ * manager.add("transfer_line", "transfer_line.grc", flowgraph::BuildOptions(), 2);
+ * manager.start_all();
+ * ...
+ * manager.reload("ring");
+ * \endcode
+ *
+ * The methods of the manager are serialized, the flowgraphs returned by graph()
+ * must not be used across a reload or remove of the same flowgraph.
+ */
+class FLOWGRAPH_API FlowGraphManager
+{
+public:
+    explicit FlowGraphManager(const ManagerLimits &limits);
+
+    /*!
+     * Stops and destroys all flowgraphs, the thread budget of the process is
+     * left as set.
+     */
+    ~FlowGraphManager();
+
+    FlowGraphManager(const FlowGraphManager &) = delete;
+    FlowGraphManager &operator=(const FlowGraphManager &) = delete;
+
+    /*!
+     * \brief Builds the flowgraph in the given GRC file, without starting it.
+     *
+     * \param cpus number of CPUs handed to the flowgraph, used as pinning_cpus
+     * with the CHAIN policy unless the options choose another one. 0 leaves
+     * the options as they are.
+     */
+    void add(const std::string &name, const std::string &path, const BuildOptions &options, size_t cpus = 0);
+
+    /*!
+     * \brief Stops and destroys the flowgraph, returning its CPUs.
+     */
+    void remove(const std::string &name);
+
+    /*!
+     * \brief Rebuilds the flowgraph from its GRC file with the same options and
+     * CPUs, restarting it if it was running.
+     *
+     * If the rebuild fails, the flowgraph is built again from the file it was
+     * last built from and the exception is rethrown.
+     *
+     * \param transfer_state take the unchanged stateful blocks over with their
+     * state, see make_flowgraph with a previous flowgraph.
+     */
+    void reload(const std::string &name, bool transfer_state = false);
+
+    void start(const std::string &name);
+    void stop(const std::string &name);
+    void start_all();
+    void stop_all();
+
+    FlowGraph *graph(const std::string &name);
+
+    std::vector<std::string> names() const;
+
+    ManagerMetrics metrics() const;
+
+private:
+    struct ManagedGraph
+    {
+        std::string path;
+        std::string contents; // of the GRC file the flowgraph was last built from
+        BuildOptions options;
+        std::vector<int> cpus;
+        std::unique_ptr<FlowGraph> graph;
+        bool running;
+        size_t reloads;
+    };
+
+    ManagedGraph &find(const std::string &name);
+    size_t memory_used_by_others(const std::string &name) const;
+    std::unique_ptr<FlowGraph> build(const std::string &name, const ManagedGraph &managed, const std::string &contents,
+            FlowGraph *previous = nullptr);
+    std::vector<int> take_cpus(size_t count);
+    void return_cpus(const std::vector<int> &cpus);
+    void stop_graph(ManagedGraph &managed);
+
+    ManagerLimits d_limits;
+    std::vector<int> d_free_cpus;
+    std::map<std::string, ManagedGraph> d_graphs;
+    mutable std::mutex d_mutex;
+};
+
+}
+
+#endif /* _FLOWGRAPH_FLOWGRAPH_MANAGER_H_ */
@@ -7,12 +7,23 @@
 #include "exprtk_impl.h"
 #include "exprtk.hpp"
 
+#include <cstdlib>
+
 
 namespace flowgraph {
   namespace detail {
 
     double evaluate_expression(const std::string &expr_string, const std::map<std::string, double> &variables)
     {
+        // plain numbers, e.g. constant-folded parameters, don't need the parser
+        if (!expr_string.empty() && expr_string.find_first_not_of("0123456789.eE+-") == std::string::npos) {
+            char *end = nullptr;
+            double value = std::strtod(expr_string.c_str(), &end);
+            if (end == expr_string.c_str() + expr_string.size()) {
+                return value;
+            }
+        }
+
         exprtk::symbol_table<double> symbol_table;
 
         for (const auto& variable : variables) {
@@ -27,6 +38,26 @@ namespace flowgraph {
 
         return expression.value();
     }
+
+    bool is_valid_expression(const std::string &expr_string, const std::map<std::string, double> &variables, std::string &error)
+    {
+        exprtk::symbol_table<double> symbol_table;
+
+        for (const auto& variable : variables) {
+            symbol_table.add_constant(variable.first, variable.second);
+        }
+
+        exprtk::expression<double> expression;
+        expression.register_symbol_table(symbol_table);
+
+        exprtk::parser<double> parser;
+        if (!parser.compile(expr_string, expression)) {
+            error = parser.error();
+            return false;
+        }
+
+        return true;
+    }
   }
 }
 
@@ -19,6 +19,11 @@ namespace flowgraph {
      * Implemented in a seperate compilation unit to avoid long compilation times.
      */
     double evaluate_expression(const std::string &expr_string, const std::map<std::string, double> &variables);
+
+    /*!
+     * Returns false and sets error if the expression does not compile.
+     */
+    bool is_valid_expression(const std::string &expr_string, const std::map<std::string, double> &variables, std::string &error);
   }
 }
 
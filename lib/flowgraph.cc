@@ -0,0 +1,1267 @@
+/* -*- c++ -*- */
+/*
+ * Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ *
+ * Co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+#include <flowgraph/flowgraph.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include <gnuradio/block.h>
+#include <gnuradio/block_detail.h>
+#include <gnuradio/buffer.h>
+#include <gnuradio/realtime.h>
+#include <gnuradio/blocks/copy.h>
+#include <gnuradio/blocks/null_sink.h>
+
+#include "flowgraph_impl.h"
+
+namespace flowgraph {
+
+/*!
+ * GNU Radio reads GR_SCHEDULER once, when the first top block of the process is
+ * started, and keeps that scheduler for all top blocks started later.
+ */
+static std::mutex scheduler_mutex;
+static std::string process_scheduler;
+
+void FlowGraph::select_scheduler()
+{
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    const auto &requested = d_build_report.scheduler_requested;
+
+    if (process_scheduler.empty()) {
+        if (!requested.empty()) {
+            setenv("GR_SCHEDULER", requested.c_str(), 1);
+        }
+        // GNU Radio falls back to TPB for unknown values
+        const char *env = getenv("GR_SCHEDULER");
+        process_scheduler = env && std::string(env) == "STS" ? "STS" : "TPB";
+    }
+
+    d_build_report.scheduler = process_scheduler;
+    if (!requested.empty() && requested != process_scheduler) {
+        std::cerr << "scheduler " << requested << " requested but the process already runs "
+                  << process_scheduler << ", running with " << process_scheduler << "\n";
+    }
+}
+
+static std::mutex threads_mutex;
+static size_t process_thread_budget = 0;
+static size_t process_threads = 0;
+
+void set_thread_budget(size_t threads)
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    process_thread_budget = threads;
+}
+
+size_t thread_budget()
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    return process_thread_budget;
+}
+
+size_t scheduler_threads()
+{
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    return process_threads;
+}
+
+void FlowGraph::reserve_threads()
+{
+    // the internal blocks of hierarchical blocks are only known once started, see account_threads
+    size_t needed = 0;
+    for (const auto &entry : d_block_map) {
+        if (boost::dynamic_pointer_cast<gr::block>(entry.second.block)) {
+            needed++;
+        }
+    }
+    if (d_build_report.scheduler == "STS") {
+        needed = 1;
+    }
+
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    if (process_thread_budget && process_threads + needed > process_thread_budget) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph "
+                << d_top_block->name() << " needs at least " << needed << " scheduler threads, "
+                << process_threads << " of the budget of " << process_thread_budget << " are in use";
+        throw std::runtime_error(message.str());
+    }
+}
+
+void FlowGraph::account_threads(size_t threads)
+{
+    std::unique_lock<std::mutex> lock(threads_mutex);
+    if (process_thread_budget && process_threads + threads > process_thread_budget) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph "
+                << d_top_block->name() << " started " << threads << " scheduler threads, "
+                << process_threads << " of the budget of " << process_thread_budget << " are in use";
+        lock.unlock();
+
+        d_top_block->stop();
+        d_top_block->wait();
+        d_started = false;
+        d_thread_ids.clear();
+        throw std::runtime_error(message.str());
+    }
+
+    d_build_report.threads = threads;
+    process_threads += threads;
+}
+
+void FlowGraph::release_threads()
+{
+    d_thread_ids.clear();
+
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    process_threads -= std::min(process_threads, d_build_report.threads);
+    d_build_report.threads = 0;
+}
+
+/*!
+ * Readers of all output buffers of the given blocks. For hierarchical consumers,
+ * e.g. cascade_sink, the readers are their internal blocks.
+ */
+static std::vector<gr::buffer_reader *> output_readers(const std::vector<gr::basic_block_sptr> &blocks)
+{
+    std::vector<gr::buffer_reader *> readers;
+    for (const auto &basic_block : blocks) {
+        auto block = boost::dynamic_pointer_cast<gr::block>(basic_block);
+        if (!block || !block->detail()) {
+            continue;
+        }
+        for (int port = 0; port < block->detail()->noutputs(); port++) {
+            auto buffer = block->detail()->output(port);
+            for (size_t i = 0; i < buffer->nreaders(); i++) {
+                readers.push_back(buffer->reader(i));
+            }
+        }
+    }
+    return readers;
+}
+
+DrainReport FlowGraph::drain(double timeout)
+{
+    DrainReport report;
+    auto begin = std::chrono::steady_clock::now();
+
+    // the digitizers and everything they feed
+    std::set<std::string> drained;
+    std::vector<gr::basic_block_sptr> digitizers;
+    digitizers_apply([&](const std::string &id, gr::digitizers::digitizer_block *digitizer) {
+        if (digitizer && digitizer->is_armed()) {
+            digitizer->disarm();
+        }
+        digitizers.push_back(d_block_map.at(id).block);
+        drained.insert(id);
+        for (const auto &downstream : d_topology.downstream(id)) {
+            drained.insert(downstream);
+        }
+    });
+
+    for (const auto &entry : d_block_map) {
+        const auto &type = entry.second.type;
+        bool digitizer = std::find(digitizer_keys.begin(), digitizer_keys.end(), type) != digitizer_keys.end();
+        if (!digitizer && d_topology.edges_to(entry.first).empty() && !d_topology.edges_from(entry.first).empty()) {
+            report.free_running.push_back(entry.first);
+        }
+    }
+
+    // blocks also fed by a free running source never run dry
+    for (const auto &source : report.free_running) {
+        for (const auto &downstream : d_topology.downstream(source)) {
+            drained.erase(downstream);
+        }
+    }
+
+    std::vector<gr::basic_block_sptr> blocks;
+    for (const auto &id : drained) {
+        blocks.push_back(d_block_map.at(id).block);
+    }
+
+    auto readers = d_started ? output_readers(blocks) : std::vector<gr::buffer_reader *>();
+
+    // flushed items are counted where they leave the digitizers, once per output
+    std::map<gr::buffer *, std::vector<gr::buffer_reader *>> digitizer_outputs;
+    for (auto reader : d_started ? output_readers(digitizers) : std::vector<gr::buffer_reader *>()) {
+        digitizer_outputs[reader->buffer().get()].push_back(reader);
+    }
+    std::map<gr::buffer_reader *, uint64_t> read_before;
+    for (const auto &output : digitizer_outputs) {
+        for (auto reader : output.second) {
+            read_before[reader] = reader->nitems_read();
+        }
+    }
+
+    auto deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    // consuming from one buffer fills the next one, all have to be empty at once
+    report.complete = false;
+    while (!report.complete) {
+        report.complete = std::all_of(readers.begin(), readers.end(),
+                [](gr::buffer_reader *reader) { return reader->items_available() == 0; });
+        if (report.complete || std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    for (const auto &output : digitizer_outputs) {
+        uint64_t flushed = 0;
+        for (auto reader : output.second) {
+            flushed = std::max(flushed, reader->nitems_read() - read_before[reader]);
+        }
+        report.flushed_items += flushed;
+    }
+
+    stop();
+    wait();
+    report.duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return report;
+}
+
+static std::mutex naming_mutex;
+static unsigned long naming_count = 0;
+
+/*!
+ * The kernel thread id of a scheduler thread, -1 if it can't be found. GNU Radio
+ * names its threads <block name><unique id>, truncated to 15 characters and so
+ * not unique. The thread is given a name unique in the process for a moment, see
+ * pthread_setname_np(3), and found by that name in /proc/self/task/<tid>/comm.
+ */
+static long thread_id(gr::thread::gr_thread_t thread)
+{
+    std::lock_guard<std::mutex> lock(naming_mutex);
+
+    char name[16];
+    if (pthread_getname_np(thread, name, sizeof(name)) != 0) {
+        return -1;
+    }
+    auto tag = "flowgraph_" + std::to_string(naming_count++ % 100000);
+    if (pthread_setname_np(thread, tag.c_str()) != 0) {
+        return -1;
+    }
+
+    long found = -1;
+    DIR *tasks = opendir("/proc/self/task");
+    while (tasks && found < 0) {
+        auto entry = readdir(tasks);
+        if (!entry) {
+            break;
+        }
+        std::ifstream file(std::string("/proc/self/task/") + entry->d_name + "/comm");
+        std::string comm;
+        if (entry->d_name[0] != '.' && std::getline(file, comm) && comm == tag) {
+            found = std::atol(entry->d_name);
+        }
+    }
+    if (tasks) {
+        closedir(tasks);
+    }
+
+    pthread_setname_np(thread, name);
+    return found;
+}
+
+/*!
+ * Start time of a thread of the process, field 22 of /proc/self/task/<tid>/stat,
+ * see proc(5), 0 if there is no such thread. Kernel thread ids are reused, the
+ * id and the start time identify a thread.
+ */
+static unsigned long long thread_start_time(long tid)
+{
+    std::ifstream file("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string stat;
+    if (!std::getline(file, stat)) {
+        return 0;
+    }
+
+    // the name in parentheses may contain spaces, the fields after it, from 3 on, don't
+    auto name_end = stat.rfind(')');
+    if (name_end == std::string::npos) {
+        return 0;
+    }
+    std::istringstream fields(stat.substr(name_end + 1));
+    std::string field;
+    for (int i = 3; i < 22; i++) {
+        fields >> field;
+    }
+    unsigned long long start_time = 0;
+    fields >> start_time;
+    return start_time;
+}
+
+static bool thread_running(long tid, unsigned long long start_time)
+{
+    return start_time && thread_start_time(tid) == start_time;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+TeardownReport FlowGraph::stop_for(double timeout)
+{
+    TeardownReport report;
+    auto begin = std::chrono::steady_clock::now();
+
+    stop_load_shedding();
+    d_top_block->stop();
+    d_started = false;
+    d_paused = false;
+    d_paused_digitizers.clear();
+    report.stop_duration = seconds_since(begin);
+
+    // the block threads leave their work calls at the next interruption point
+    auto exit_begin = std::chrono::steady_clock::now();
+    auto deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    while (true) {
+        std::set<std::string> running;
+        for (const auto &thread : d_thread_ids) {
+            if (thread_running(thread.first, thread.second.start_time)) {
+                running.insert(thread.second.block_id);
+            }
+        }
+        report.running.assign(running.begin(), running.end());
+        if (report.running.empty() || std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    report.exit_duration = seconds_since(exit_begin);
+
+    // joining blocks as long as a thread is still inside a work call
+    report.complete = report.running.empty();
+    if (report.complete) {
+        auto wait_begin = std::chrono::steady_clock::now();
+        d_top_block->wait();
+        release_threads();
+        report.wait_duration = seconds_since(wait_begin);
+    }
+    return report;
+}
+
+TeardownReport FlowGraph::teardown(double timeout)
+{
+    auto report = stop_for(timeout);
+    if (!report.complete) {
+        return report;
+    }
+
+    auto disconnect_begin = std::chrono::steady_clock::now();
+    d_top_block->disconnect_all();
+    report.disconnect_duration = seconds_since(disconnect_begin);
+
+    // once disconnected, the blocks don't reference each other any more
+    auto destroy_begin = std::chrono::steady_clock::now();
+    std::vector<gr::basic_block_sptr> blocks;
+    for (auto &entry : d_block_map) {
+        blocks.push_back(entry.second.block);
+    }
+    d_block_map.clear();
+    d_topology = Topology();
+    d_priorities.clear();
+    d_valves.clear();
+    d_null_sinks.clear();
+    d_shed_orders.clear();
+
+    // the top block keeps the flattened graph of the last run, replace it while
+    // the blocks are still referenced here, so that they are released below
+    d_top_block = gr::make_top_block(d_top_block->name());
+
+    size_t workers = std::min<size_t>(blocks.size(), std::max(1u, std::min(8u, std::thread::hardware_concurrency())));
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < workers; worker++) {
+        threads.push_back(std::thread([&blocks, worker, workers]() {
+            for (size_t i = worker; i < blocks.size(); i += workers) {
+                blocks[i].reset();
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    report.destroy_duration = seconds_since(destroy_begin);
+    return report;
+}
+
+/*!
+ * The scheduler thread of a block sets threaded before its own handle.
+ */
+static bool thread_started(const gr::block_sptr &block)
+{
+    return block->detail() && block->detail()->threaded && block->detail()->thread != gr::thread::gr_thread_t();
+}
+
+/*!
+ * Waits until the scheduler threads of all blocks run, at most timeout seconds.
+ */
+static bool wait_for_threads(const std::vector<gr::block_sptr> &blocks, double timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    for (const auto &block : blocks) {
+        while (!thread_started(block)) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    return true;
+}
+
+/*!
+ * All blocks run by the scheduler of a started flowgraph, including the internal
+ * blocks of hierarchical blocks, found by following the buffers between them.
+ */
+static std::vector<gr::block_sptr> flattened_blocks(const std::vector<gr::basic_block_sptr> &blocks)
+{
+    std::vector<gr::block_sptr> flattened, pending;
+    std::set<gr::block *> seen;
+    auto visit = [&](const gr::block_sptr &block) {
+        if (block && block->detail() && seen.insert(block.get()).second) {
+            pending.push_back(block);
+        }
+    };
+
+    for (const auto &block : blocks) {
+        visit(boost::dynamic_pointer_cast<gr::block>(block));
+    }
+
+    while (!pending.empty()) {
+        auto block = pending.back();
+        pending.pop_back();
+        flattened.push_back(block);
+
+        auto detail = block->detail();
+        for (int port = 0; port < detail->ninputs(); port++) {
+            visit(detail->input(port)->buffer()->link());
+        }
+        for (int port = 0; port < detail->noutputs(); port++) {
+            auto buffer = detail->output(port);
+            for (size_t i = 0; i < buffer->nreaders(); i++) {
+                visit(buffer->reader(i)->link());
+            }
+        }
+    }
+
+    return flattened;
+}
+
+size_t FlowGraph::record_thread_ids()
+{
+    d_thread_ids.clear();
+    if (d_build_report.scheduler == "STS") {
+        return 1; // no per-block threads
+    }
+
+    std::vector<gr::basic_block_sptr> blocks;
+    std::map<gr::basic_block *, std::string> ids;
+    for (const auto &entry : d_block_map) {
+        blocks.push_back(entry.second.block);
+        ids[entry.second.block.get()] = entry.first;
+    }
+
+    // the scheduler creates the threads asynchronously
+    auto flattened = flattened_blocks(blocks);
+    wait_for_threads(flattened, 1.0);
+
+    for (const auto &block : flattened) {
+        if (!thread_started(block)) {
+            continue;
+        }
+        auto tid = thread_id(block->detail()->thread);
+        auto start_time = tid > 0 ? thread_start_time(tid) : 0;
+        if (start_time) {
+            auto id = ids.find(block.get());
+            BlockThread thread = {id != ids.end() ? id->second : block->alias(), start_time};
+            d_thread_ids[tid] = thread;
+        }
+    }
+
+    return flattened.size();
+}
+
+void FlowGraph::set_branch_enabled(const std::string &id, bool enabled)
+{
+    auto it = d_valves.find(id);
+    if (it == d_valves.end()) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": block " << id
+                << " has no branch valve, see BuildOptions::branch_valves";
+        throw std::invalid_argument(message.str());
+    }
+
+    for (const auto &valve_id : it->second) {
+        boost::dynamic_pointer_cast<gr::blocks::copy>(d_block_map.at(valve_id).block)->set_enabled(enabled);
+    }
+}
+
+ReconnectReport FlowGraph::reconnect(const std::string &src, int src_port, const std::string &dst, int dst_port)
+{
+    for (const auto &id : {src, dst}) {
+        if (!d_block_map.count(id)) {
+            std::ostringstream message;
+            message << "Exception in " << __FILE__ << ":" << __LINE__ << ": block " << id << " not found!";
+            throw std::invalid_argument(message.str());
+        }
+    }
+
+    // a valve in front of dst keeps its place, see BuildOptions::branch_valves
+    std::string target = dst;
+    int target_port = dst_port;
+    auto valve_id = dst + "_valve_" + std::to_string(dst_port);
+    auto valves = d_valves.find(dst);
+    if (valves != d_valves.end() && std::find(valves->second.begin(), valves->second.end(), valve_id) != valves->second.end()) {
+        target = valve_id;
+        target_port = 0;
+    }
+
+    auto src_block = d_block_map.at(src).block;
+    auto dst_block = d_block_map.at(target).block;
+    size_t item_size = src_block->output_signature()->sizeof_stream_item(src_port);
+    size_t dst_item_size = dst_block->input_signature()->sizeof_stream_item(target_port);
+    if (item_size != dst_item_size) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": can't connect " << src << ":" << src_port
+                << " with items of " << item_size << " bytes to " << dst << ":" << dst_port
+                << " taking items of " << dst_item_size << " bytes";
+        throw std::invalid_argument(message.str());
+    }
+
+    ReconnectReport report;
+    Edge added = {src, src_port, target, target_port, item_size};
+    report.added = added;
+    report.running = d_started;
+
+    auto old_edges = d_topology.edges_to(target, target_port);
+    if (!old_edges.empty()) {
+        report.removed = old_edges.front();
+        if (report.removed.src_id == src && report.removed.src_port == src_port) {
+            return report;
+        }
+    }
+
+    // GNU Radio refuses output ports without consumers
+    gr::basic_block_sptr null_sink;
+    if (!old_edges.empty() && d_topology.edges_from(report.removed.src_id, report.removed.src_port).size() == 1) {
+        // the block ids of the GRC file may already use the name
+        auto base = report.removed.src_id + "_null_" + std::to_string(report.removed.src_port);
+        report.null_sink = base;
+        for (int suffix = 2; d_block_map.count(report.null_sink); suffix++) {
+            report.null_sink = base + "_" + std::to_string(suffix);
+        }
+        null_sink = gr::blocks::null_sink::make(report.removed.item_size);
+    }
+
+    // a null sink left by an earlier reconnect is replaced by the new consumer
+    Edge null_edge = Edge();
+    for (const auto &edge : d_topology.edges_from(src, src_port)) {
+        if (d_null_sinks.count(edge.dst_id)) {
+            null_edge = edge;
+            report.removed_null_sink = edge.dst_id;
+        }
+    }
+
+    // like reserve_threads for start, an edit exceeding the thread budget is refused
+    // before the running flowgraph is touched
+    int thread_delta = 0;
+    if (d_started && d_build_report.scheduler != "STS") {
+        thread_delta = (null_sink ? 1 : 0) - (report.removed_null_sink.empty() ? 0 : 1);
+    }
+    if (thread_delta > 0) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        if (process_thread_budget && process_threads + thread_delta > process_thread_budget) {
+            std::ostringstream message;
+            message << "Exception in " << __FILE__ << ":" << __LINE__ << ": the null sink terminating "
+                    << report.removed.src_id << ":" << report.removed.src_port << " exceeds the thread budget, "
+                    << process_threads << " of " << process_thread_budget << " are in use";
+            throw std::runtime_error(message.str());
+        }
+    }
+
+    // the load shedding controller holds the buffers replaced by unlock
+    stop_load_shedding();
+
+    auto begin = std::chrono::steady_clock::now();
+    if (d_started) {
+        d_top_block->lock();
+    }
+    try {
+        if (!old_edges.empty()) {
+            d_top_block->disconnect(d_block_map.at(report.removed.src_id).block, report.removed.src_port, dst_block, target_port);
+        }
+        if (null_sink) {
+            d_top_block->connect(d_block_map.at(report.removed.src_id).block, report.removed.src_port, null_sink, 0);
+        }
+        if (!report.removed_null_sink.empty()) {
+            d_top_block->disconnect(src_block, src_port, d_block_map.at(null_edge.dst_id).block, 0);
+        }
+        d_top_block->connect(src_block, src_port, dst_block, target_port);
+    }
+    catch (...) {
+        if (d_started) {
+            d_top_block->unlock();
+            start_load_shedding();
+        }
+        throw;
+    }
+    report.lock_duration = seconds_since(begin);
+
+    if (d_started) {
+        d_top_block->unlock();
+    }
+    report.interruption = seconds_since(begin);
+
+    // edge records follow the top block
+    if (!old_edges.empty()) {
+        d_topology.remove_edge(report.removed);
+    }
+    if (null_sink) {
+        d_block_map[report.null_sink] = FlowGraphEntry{null_sink, blocks_null_sink_key, std::string()};
+        d_null_sinks.insert(report.null_sink);
+        Edge edge = {report.removed.src_id, report.removed.src_port, report.null_sink, 0, report.removed.item_size};
+        d_topology.add_edge(edge);
+    }
+    if (!report.removed_null_sink.empty()) {
+        d_topology.remove_edge(null_edge);
+        d_block_map.erase(null_edge.dst_id);
+        d_null_sinks.erase(null_edge.dst_id);
+    }
+    d_topology.add_edge(added);
+
+    // unlock restarts the block threads, counted without stopping the flowgraph,
+    // the budget was checked before the edit
+    if (d_started) {
+        auto threads = record_thread_ids();
+        {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            process_threads -= std::min(process_threads, d_build_report.threads);
+            process_threads += threads;
+            d_build_report.threads = threads;
+        }
+        apply_thread_priorities();
+        start_load_shedding();
+    }
+    return report;
+}
+
+bool FlowGraph::branch_enabled(const std::string &id) const
+{
+    auto it = d_valves.find(id);
+    if (it == d_valves.end() || it->second.empty()) {
+        return true;
+    }
+    auto valve = boost::dynamic_pointer_cast<gr::blocks::copy>(d_block_map.at(it->second.front()).block);
+    return valve->enabled();
+}
+
+static std::string realtime_status_message(gr::rt_status_t status)
+{
+    switch (status) {
+    case gr::RT_OK:              return "granted";
+    case gr::RT_NOT_IMPLEMENTED: return "not implemented on this platform";
+    case gr::RT_NO_PRIVS:        return "insufficient privileges (CAP_SYS_NICE or an rtprio limit is needed)";
+    default:                     return "failed";
+    }
+}
+
+void FlowGraph::start_threads(int max_noutput_items)
+{
+    select_scheduler();
+    reserve_threads();
+
+    // like GRC generated code, switch the calling thread to realtime scheduling right
+    // before the start, the scheduler threads inherit its policy
+    if (d_build_report.realtime_requested) {
+        auto status = gr::enable_realtime_scheduling();
+        d_build_report.realtime_granted = status == gr::RT_OK;
+        d_build_report.realtime_status = realtime_status_message(status);
+
+        if (!d_build_report.realtime_granted) {
+            std::cerr << "realtime scheduling requested but not granted: " << d_build_report.realtime_status
+                      << ", running with normal scheduling\n";
+        }
+    }
+
+    d_top_block->start(max_noutput_items);
+    d_started = true;
+    account_threads(record_thread_ids());
+    apply_thread_priorities();
+    start_load_shedding();
+}
+
+/*!
+ * Busy and total jiffies of all CPUs of the host, from /proc/stat.
+ */
+static bool host_cpu_times(unsigned long long &busy, unsigned long long &total)
+{
+    std::ifstream stat("/proc/stat");
+    std::string cpu;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    if (!(stat >> cpu >> user >> nice >> system >> idle >> iowait >> irq >> softirq >> steal) || cpu != "cpu") {
+        return false;
+    }
+    total = user + nice + system + idle + iowait + irq + softirq + steal;
+    busy = total - idle - iowait;
+    return true;
+}
+
+/*!
+ * Degrades and restores the annotated branches of a running flowgraph, see
+ * LoadShedding. The load is measured every interval, the valves of degraded
+ * branches are switched every cycle.
+ */
+class LoadSheddingController
+{
+public:
+    LoadSheddingController(const LoadShedding &config, const std::map<std::string, int> &orders,
+            const std::map<std::string, std::vector<gr::blocks::copy::sptr>> &valves,
+            const std::vector<gr::buffer_sptr> &source_buffers) :
+        d_config(config),
+        d_orders(orders),
+        d_valves(valves),
+        d_source_buffers(source_buffers),
+        d_begin(std::chrono::steady_clock::now()),
+        d_stop(false)
+    {
+        d_report.max_step = load_shedding_steps(orders);
+        d_report.divisors = plan_load_shedding(orders, 0);
+        d_thread = std::thread([this]() { run(); });
+    }
+
+    ~LoadSheddingController()
+    {
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_stop = true;
+        }
+        d_wakeup.notify_all();
+        d_thread.join();
+
+        for (const auto &entry : d_valves) {
+            set_valves(entry.first, true);
+        }
+    }
+
+    LoadSheddingReport report() const
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return d_report;
+    }
+
+private:
+    static const size_t max_log = 1000;
+
+    void set_valves(const std::string &id, bool open)
+    {
+        for (const auto &valve : d_valves.at(id)) {
+            valve->set_enabled(open);
+        }
+    }
+
+    double backpressure() const
+    {
+        double fill = 0.0;
+        for (const auto &buffer : d_source_buffers) {
+            if (buffer->bufsize() > 0) {
+                fill = std::max(fill, 1.0 - double(buffer->space_available()) / buffer->bufsize());
+            }
+        }
+        return fill;
+    }
+
+    // one step per decision, so that the load can settle in between
+    void decide(double cpu, double pressure)
+    {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        d_report.cpu = cpu;
+        d_report.backpressure = pressure;
+
+        size_t step = d_report.step;
+        if ((cpu >= d_config.shed_cpu || pressure >= d_config.shed_backpressure) && step < d_report.max_step) {
+            step++;
+            d_report.sheds++;
+        }
+        else if (cpu <= d_config.restore_cpu && pressure <= d_config.restore_backpressure && step > 0) {
+            step--;
+            d_report.restores++;
+        }
+        if (step == d_report.step) {
+            return;
+        }
+        d_report.step = step;
+
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - d_begin).count();
+        for (const auto &entry : plan_load_shedding(d_orders, step)) {
+            if (d_report.divisors[entry.first] == entry.second) {
+                continue;
+            }
+            d_report.divisors[entry.first] = entry.second;
+            d_report.actions[entry.first]++;
+
+            SheddingAction action = {time, entry.first, entry.second, cpu, pressure};
+            d_report.log.push_back(action);
+            if (d_report.log.size() > max_log) {
+                d_report.log.erase(d_report.log.begin());
+            }
+
+            std::cerr << "load shedding: " << entry.first << " "
+                      << (entry.second == 1 ? "restored" : entry.second ? "open 1/" + std::to_string(entry.second) : "closed")
+                      << " (cpu " << int(cpu * 100) << "%, backpressure " << int(pressure * 100) << "%)\n";
+        }
+    }
+
+    void run()
+    {
+        size_t cycles_per_decision = std::max(1.0, std::round(d_config.interval / d_config.cycle));
+        auto cycle = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(d_config.cycle));
+
+        unsigned long long busy = 0, total = 0;
+        host_cpu_times(busy, total);
+
+        std::map<std::string, bool> open;
+        for (size_t n = 1; ; n++) {
+            std::map<std::string, int> divisors;
+            {
+                std::unique_lock<std::mutex> lock(d_mutex);
+                if (d_wakeup.wait_for(lock, cycle, [this]() { return d_stop; })) {
+                    return;
+                }
+                divisors = d_report.divisors;
+            }
+
+            for (const auto &entry : divisors) {
+                bool should_open = entry.second == 1 || (entry.second > 1 && n % entry.second == 0);
+                auto it = open.find(entry.first);
+                if (it == open.end() || it->second != should_open) {
+                    set_valves(entry.first, should_open);
+                    open[entry.first] = should_open;
+                }
+            }
+
+            if (n % cycles_per_decision == 0) {
+                unsigned long long now_busy = 0, now_total = 0;
+                double cpu = 0.0;
+                if (host_cpu_times(now_busy, now_total) && now_total > total) {
+                    cpu = double(now_busy - busy) / (now_total - total);
+                }
+                busy = now_busy;
+                total = now_total;
+                decide(cpu, backpressure());
+            }
+        }
+    }
+
+    LoadShedding d_config;
+    std::map<std::string, int> d_orders;
+    std::map<std::string, std::vector<gr::blocks::copy::sptr>> d_valves;
+    std::vector<gr::buffer_sptr> d_source_buffers;
+    std::chrono::steady_clock::time_point d_begin;
+
+    mutable std::mutex d_mutex;
+    std::condition_variable d_wakeup;
+    bool d_stop;
+    LoadSheddingReport d_report;
+    std::thread d_thread;
+};
+
+void FlowGraph::start_load_shedding()
+{
+    if (!d_load_shedding.enabled || d_shed_orders.empty() || d_shedding) {
+        return;
+    }
+
+    // sources have no input to cut off
+    std::map<std::string, int> orders;
+    std::map<std::string, std::vector<gr::blocks::copy::sptr>> valves;
+    for (const auto &entry : d_shed_orders) {
+        auto it = d_valves.find(entry.first);
+        if (it == d_valves.end()) {
+            continue;
+        }
+        orders.insert(entry);
+        for (const auto &valve_id : it->second) {
+            valves[entry.first].push_back(boost::dynamic_pointer_cast<gr::blocks::copy>(d_block_map.at(valve_id).block));
+        }
+    }
+    if (orders.empty()) {
+        return;
+    }
+
+    // backpressure shows at the sources first, the digitizers can't hand samples over
+    std::vector<gr::buffer_sptr> buffers;
+    for (const auto &entry : d_block_map) {
+        auto block = boost::dynamic_pointer_cast<gr::block>(entry.second.block);
+        if (!block || !block->detail() || !d_topology.edges_to(entry.first).empty()) {
+            continue;
+        }
+        for (int port = 0; port < block->detail()->noutputs(); port++) {
+            buffers.push_back(block->detail()->output(port));
+        }
+    }
+
+    d_shedding = std::make_shared<LoadSheddingController>(d_load_shedding, orders, valves, buffers);
+}
+
+void FlowGraph::stop_load_shedding()
+{
+    if (d_shedding) {
+        d_last_shedding_report = d_shedding->report();
+        d_shedding.reset();
+    }
+}
+
+LoadSheddingReport FlowGraph::load_shedding_report() const
+{
+    return d_shedding ? d_shedding->report() : d_last_shedding_report;
+}
+
+GroupStartReport FlowGraph::start_group(const std::vector<FlowGraph *> &graphs)
+{
+    GroupStartReport report;
+    auto begin = std::chrono::steady_clock::now();
+
+    // a failed start leaves none of the flowgraphs running
+    auto stop_all = [&graphs]() {
+        for (auto graph : graphs) {
+            if (graph->d_started) {
+                graph->stop();
+                graph->wait();
+            }
+        }
+    };
+
+    std::vector<gr::block_sptr> blocks;
+    for (auto graph : graphs) {
+        try {
+            graph->start_threads(graph->d_build_report.max_noutput_items);
+        }
+        catch (...) {
+            stop_all();
+            throw;
+        }
+        graph->d_build_report.startup = StartupReport();
+        if (graph->d_build_report.scheduler == "STS") {
+            continue; // no per-block threads to wait for
+        }
+
+        for (const auto &entry : graph->d_block_map) {
+            auto block = boost::dynamic_pointer_cast<gr::block>(entry.second.block);
+            if (block) {
+                blocks.push_back(block);
+            }
+        }
+    }
+
+    if (!wait_for_threads(blocks, 1.0)) {
+        std::cerr << "not all block threads run after 1 s, arming the digitizers anyway\n";
+    }
+
+    // one thread per digitizer, all waiting for the same release
+    std::promise<void> release;
+    std::shared_future<void> barrier = release.get_future().share();
+    std::vector<std::thread> threads;
+    std::vector<std::chrono::steady_clock::time_point> armed_at;
+    std::vector<GroupStartReport::Arming> armed;
+    std::atomic<size_t> waiting(0);
+
+    for (size_t i = 0; i < graphs.size(); i++) {
+        graphs[i]->digitizers_apply([&](const std::string &id, gr::digitizers::digitizer_block *digitizer) {
+            if (!digitizer) {
+                return;
+            }
+            if (digitizer->is_armed()) {
+                report.unsynchronized.push_back(std::to_string(i) + ":" + id);
+                return;
+            }
+            GroupStartReport::Arming arming = {i, id, 0.0};
+            armed.push_back(arming);
+        });
+    }
+    armed_at.resize(armed.size());
+    std::vector<std::exception_ptr> errors(armed.size());
+
+    for (size_t i = 0; i < armed.size(); i++) {
+        auto digitizer = graphs[armed[i].graph]->get_block<gr::digitizers::digitizer_block>(armed[i].block_id);
+        threads.push_back(std::thread([digitizer, barrier, &armed_at, &errors, &waiting, i]() {
+            waiting++;
+            barrier.wait();
+            try {
+                digitizer->arm();
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+            armed_at[i] = std::chrono::steady_clock::now();
+        }));
+    }
+
+    while (waiting < threads.size()) {
+        std::this_thread::yield();
+    }
+    report.prepare_duration = seconds_since(begin);
+
+    auto released = std::chrono::steady_clock::now();
+    release.set_value();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < armed.size(); i++) {
+        if (errors[i]) {
+            std::cerr << "can't arm digitizer " << armed[i].block_id << " of flowgraph " << armed[i].graph
+                      << ", stopping the group\n";
+            stop_all();
+            std::rethrow_exception(errors[i]);
+        }
+    }
+
+    for (size_t i = 0; i < armed.size(); i++) {
+        armed[i].offset = std::chrono::duration<double>(armed_at[i] - released).count();
+        graphs[armed[i].graph]->d_build_report.startup.armed.push_back(armed[i].block_id);
+    }
+    if (!armed.empty()) {
+        auto range = std::minmax_element(armed_at.begin(), armed_at.end());
+        report.skew = std::chrono::duration<double>(*range.second - *range.first).count();
+    }
+    report.armed = armed;
+    return report;
+}
+
+void FlowGraph::sequence_start()
+{
+    auto &report = d_build_report.startup;
+    report = StartupReport();
+
+    if (d_sequenced_start) {
+        std::vector<gr::block_sptr> blocks;
+        for (const auto &entry : d_block_map) {
+            auto block = boost::dynamic_pointer_cast<gr::block>(entry.second.block);
+            if (block) {
+                blocks.push_back(block);
+            }
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        if (d_build_report.scheduler != "STS" && !wait_for_threads(blocks, 1.0)) {
+            std::cerr << "not all block threads run after 1 s, arming the digitizers anyway\n";
+        }
+        report.ready_duration = seconds_since(begin);
+
+        auto arm_begin = std::chrono::steady_clock::now();
+        digitizers_apply([&report](const std::string &id, gr::digitizers::digitizer_block *digitizer) {
+            if (digitizer && !digitizer->is_armed()) {
+                digitizer->arm();
+                report.armed.push_back(id);
+            }
+        });
+        report.arm_duration = seconds_since(arm_begin);
+    }
+
+    if (d_startup_monitor <= 0) {
+        return;
+    }
+
+    std::vector<gr::buffer_sptr> buffers;
+    digitizers_apply([&buffers](const std::string &, gr::digitizers::digitizer_block *digitizer) {
+        if (digitizer && digitizer->detail()) {
+            for (int port = 0; port < digitizer->detail()->noutputs(); port++) {
+                buffers.push_back(digitizer->detail()->output(port));
+            }
+        }
+    });
+
+    auto begin = std::chrono::steady_clock::now();
+    while (seconds_since(begin) < d_startup_monitor) {
+        bool full = std::any_of(buffers.begin(), buffers.end(),
+                [](const gr::buffer_sptr &buffer) { return buffer->space_available() == 0; });
+        report.samples++;
+        report.full_buffer_events += full ? 1 : 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+PauseReport FlowGraph::pause()
+{
+    if (!d_started) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph not started";
+        throw std::runtime_error(message.str());
+    }
+
+    PauseReport report;
+    auto begin = std::chrono::steady_clock::now();
+
+    // only digitizers armed now are re-armed by resume
+    digitizers_apply([this](const std::string &id, gr::digitizers::digitizer_block *digitizer) {
+        if (digitizer && digitizer->is_armed()) {
+            digitizer->disarm();
+            d_paused_digitizers.push_back(id);
+        }
+    });
+
+    report.duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    report.digitizers = d_paused_digitizers;
+    d_paused = true;
+
+    // sources other than digitizers keep producing
+    for (const auto &entry : d_block_map) {
+        const auto &type = entry.second.type;
+        bool digitizer = std::find(digitizer_keys.begin(), digitizer_keys.end(), type) != digitizer_keys.end();
+        if (!digitizer && d_topology.edges_to(entry.first).empty() && !d_topology.edges_from(entry.first).empty()) {
+            report.free_running.push_back(entry.first);
+        }
+    }
+    return report;
+}
+
+PauseReport FlowGraph::resume()
+{
+    PauseReport report;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (const auto &id : d_paused_digitizers) {
+        auto digitizer = get_block<gr::digitizers::digitizer_block>(id);
+        if (digitizer) {
+            digitizer->arm();
+        }
+    }
+
+    report.duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    report.digitizers.swap(d_paused_digitizers);
+    d_paused = false;
+    return report;
+}
+
+static std::string priority_text(const ThreadPriority &priority)
+{
+    std::ostringstream text;
+    switch (priority.policy) {
+    case ThreadPriority::FIFO: text << "fifo:"; break;
+    case ThreadPriority::RR:   text << "rr:"; break;
+    case ThreadPriority::NICE: text << "nice:"; break;
+    }
+    text << priority.value;
+    return text.str();
+}
+
+static std::string errno_message(int error)
+{
+    if (error == EPERM) {
+        return "insufficient privileges (CAP_SYS_NICE or an rtprio/nice limit is needed)";
+    }
+    return std::strerror(error);
+}
+
+void FlowGraph::apply_thread_priorities()
+{
+    d_build_report.priorities.clear();
+
+    std::map<std::string, long> tids;
+    for (const auto &thread : d_thread_ids) {
+        tids[thread.second.block_id] = thread.first;
+    }
+
+    for (const auto &entry : d_priorities) {
+        const auto &priority = entry.second;
+
+        PriorityResult result;
+        result.block_id = entry.first;
+        result.requested = priority_text(priority);
+        result.applied = false;
+
+        auto block = boost::dynamic_pointer_cast<gr::block>(d_block_map.at(entry.first).block);
+        if (!block) {
+            result.message = "hierarchical blocks have no thread of their own";
+            d_build_report.priorities.push_back(result);
+            continue;
+        }
+
+        if (d_build_report.scheduler == "STS") {
+            result.message = "no per-block thread under STS";
+            std::cerr << "priority " << result.requested << " of block " << result.block_id
+                      << " refused: " << result.message << "\n";
+            d_build_report.priorities.push_back(result);
+            continue;
+        }
+
+        // recorded once all threads ran or after waiting for them, see record_thread_ids
+        auto tid = tids.find(entry.first);
+        if (tid == tids.end()) {
+            result.message = "the block thread did not start";
+            d_build_report.priorities.push_back(result);
+            continue;
+        }
+
+        if (priority.policy == ThreadPriority::NICE) {
+            if (!thread_running(tid->second, d_thread_ids.at(tid->second).start_time)) {
+                result.message = "the block thread exited";
+            }
+            else if (setpriority(PRIO_PROCESS, tid->second, priority.value) != 0) {
+                result.message = errno_message(errno);
+            }
+            else {
+                result.applied = true;
+            }
+        }
+        else {
+            int policy = priority.policy == ThreadPriority::FIFO ? SCHED_FIFO : SCHED_RR;
+            struct sched_param param;
+            param.sched_priority = priority.value;
+
+            int error = pthread_setschedparam(block->detail()->thread, policy, &param);
+            if (error == EINVAL) {
+                std::ostringstream message;
+                message << "priority out of range " << sched_get_priority_min(policy)
+                        << ".." << sched_get_priority_max(policy);
+                result.message = message.str();
+            }
+            else if (error) {
+                result.message = errno_message(error);
+            }
+            else {
+                result.applied = true;
+            }
+        }
+
+        if (!result.applied) {
+            std::cerr << "priority " << result.requested << " of block " << result.block_id
+                      << " refused: " << result.message << "\n";
+        }
+        d_build_report.priorities.push_back(result);
+    }
+}
+
+}
@@ -9,9 +9,19 @@
 #include <functional>
 #include <memory>
 #include <vector>
+#include <set>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include <unistd.h>
+#include <fnmatch.h>
 
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+#include <boost/property_tree/json_parser.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/type_traits.hpp>
@@ -19,6 +29,7 @@
 #include "flowgraph_impl.h"
 
 #include <gnuradio/analog/sig_source_f.h>
+#include <gnuradio/blocks/copy.h>
 #include <gnuradio/blocks/null_sink.h>
 #include <gnuradio/blocks/null_source.h>
 #include <gnuradio/blocks/throttle.h>
@@ -167,6 +178,81 @@ int BlockMaker::getSizeOfType(std::string type)
     }
 }
 
+// item types known by getSizeOfType
+static const std::vector<std::string> stream_types = {"complex", "float", "int", "short", "byte"};
+
+/*!
+ * Parameters read by the picoscope makers. Channel, trigger and acquisition
+ * parameters are only read if enabled by other parameters.
+ */
+static std::vector<ParamSpec> picoscope_parameters(const BlockInfo &info, const std::string &channels,
+        bool digital_ports, bool digital_trigger)
+{
+    std::vector<ParamSpec> params = { {"serial_number", ParamKind::TEXT},
+            {"trigger_once", ParamKind::BOOL},
+            {"samp_rate", ParamKind::EXPRESSION},
+            {"downsampling_mode", ParamKind::INTEGER},
+            {"downsampling_factor", ParamKind::EXPRESSION},
+            {"acquisition_mode", ParamKind::TEXT, {"Streaming", "Rapid Block"}},
+            {"trigger_source", ParamKind::TEXT} };
+
+    for (char channel : channels) {
+        std::string enable = std::string("enable_ai_") + channel;
+        params.push_back(ParamSpec(enable, ParamKind::BOOL));
+
+        bool enabled = false;
+        try {
+            enabled = info.param_value<bool>(enable);
+        }
+        catch (...) {
+            // reported by the check of the enable parameter
+        }
+        if (enabled) {
+            params.push_back(ParamSpec(std::string("range_ai_") + channel, ParamKind::REAL));
+            params.push_back(ParamSpec(std::string("coupling_ai_") + channel, ParamKind::INTEGER));
+            params.push_back(ParamSpec(std::string("offset_ai_") + channel, ParamKind::REAL));
+        }
+    }
+
+    if (info.is_param_set("auto_arm")) {
+        params.push_back(ParamSpec("auto_arm", ParamKind::BOOL));
+    }
+
+    if (digital_ports) {
+        for (auto port : {"0", "1"}) {
+            params.push_back(ParamSpec(std::string("enable_di_") + port, ParamKind::BOOL));
+            params.push_back(ParamSpec(std::string("thresh_di_") + port, ParamKind::REAL));
+        }
+    }
+
+    auto trigger_source = info.params.count("trigger_source") ? info.param_value("trigger_source") : "None";
+    if (trigger_source == "Digital" && digital_trigger) {
+        params.push_back(ParamSpec("pin_number", ParamKind::INTEGER));
+        params.push_back(ParamSpec("trigger_direction", ParamKind::INTEGER));
+    }
+    else if (trigger_source != "None") {
+        params.push_back(ParamSpec("trigger_direction", ParamKind::INTEGER));
+        params.push_back(ParamSpec("trigger_threshold", ParamKind::REAL));
+    }
+
+    auto acquisition_mode = info.params.count("acquisition_mode") ? info.param_value("acquisition_mode") : "";
+    if (acquisition_mode == "Streaming") {
+        // "auto" and empty values are replaced by plan_digitizer_streaming
+        for (auto param : {"buff_size", "poll_rate"}) {
+            if (info.is_param_set(param) && info.param_value(param) != "auto") {
+                params.push_back(ParamSpec(param, ParamKind::EXPRESSION));
+            }
+        }
+    }
+    else if (acquisition_mode == "Rapid Block") {
+        params.push_back(ParamSpec("nr_waveforms", ParamKind::EXPRESSION));
+        params.push_back(ParamSpec("pre_samples", ParamKind::EXPRESSION));
+        params.push_back(ParamSpec("post_samples", ParamKind::EXPRESSION));
+    }
+
+    return params;
+}
+
 // gnuradio blocks
 
 struct NullSinkMaker : BlockMaker
@@ -179,6 +265,20 @@ struct NullSinkMaker : BlockMaker
         auto vlen = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::null_sink::make(vlen * getSizeOfType(type));
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { static_cast<size_t>(item_size) };
+        sizes.open_inputs = true;
+        return true;
+    }
 };
 
 struct NullSourceMaker : BlockMaker
@@ -191,6 +291,20 @@ struct NullSourceMaker : BlockMaker
         auto vlen = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::null_source::make(vlen * getSizeOfType(type));
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        sizes.outputs = { static_cast<size_t>(item_size) };
+        sizes.open_outputs = true;
+        return true;
+    }
 };
 
 struct UcharToFloatMaker : BlockMaker
@@ -200,6 +314,13 @@ struct UcharToFloatMaker : BlockMaker
         assert(info.key == blocks_uchar_to_float_key);
         return gr::blocks::uchar_to_float::make();
     }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        sizes.inputs = { sizeof(unsigned char) };
+        sizes.outputs = { sizeof(float) };
+        return true;
+    }
 };
 
 struct VectorToStreamMaker : BlockMaker
@@ -213,6 +334,22 @@ struct VectorToStreamMaker : BlockMaker
         auto vlen      = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::vector_to_stream::make(vlen * getSizeOfType(type), num_items);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"num_items", ParamKind::EXPRESSION},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        auto num_items = info.eval_param_value<int>("num_items", variables);
+        sizes.inputs = { static_cast<size_t>(item_size * num_items) };
+        sizes.outputs = { static_cast<size_t>(item_size) };
+        return true;
+    }
 };
 
 struct VectorToStreamsMaker : BlockMaker
@@ -226,6 +363,22 @@ struct VectorToStreamsMaker : BlockMaker
         auto vlen        = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::vector_to_streams::make(vlen * getSizeOfType(type), num_streams);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"num_streams", ParamKind::EXPRESSION},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        auto num_streams = info.eval_param_value<int>("num_streams", variables);
+        sizes.inputs = { static_cast<size_t>(item_size * num_streams) };
+        sizes.outputs.assign(std::max(num_streams, 0), static_cast<size_t>(item_size));
+        return true;
+    }
 };
 
 struct ComplexToMagMaker : BlockMaker
@@ -236,6 +389,19 @@ struct ComplexToMagMaker : BlockMaker
         int vlen = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::complex_to_mag::make(vlen);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t vlen = info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { vlen * sizeof(gr_complex) };
+        sizes.outputs = { vlen * sizeof(float) };
+        return true;
+    }
 };
 
 struct ComplexToMagPhaseMaker : BlockMaker
@@ -246,6 +412,19 @@ struct ComplexToMagPhaseMaker : BlockMaker
         int vlen = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::complex_to_magphase::make(vlen);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t vlen = info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { vlen * sizeof(gr_complex) };
+        sizes.outputs = { vlen * sizeof(float), vlen * sizeof(float) };
+        return true;
+    }
 };
 
 struct StreamToVectorMaker : BlockMaker
@@ -259,6 +438,22 @@ struct StreamToVectorMaker : BlockMaker
         auto vlen      = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::stream_to_vector::make(vlen * getSizeOfType(type), num_items);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"num_items", ParamKind::EXPRESSION},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        auto num_items = info.eval_param_value<int>("num_items", variables);
+        sizes.inputs = { static_cast<size_t>(item_size) };
+        sizes.outputs = { static_cast<size_t>(item_size * num_items) };
+        return true;
+    }
 };
 
 struct ComplexToFloatMaker : BlockMaker
@@ -269,6 +464,19 @@ struct ComplexToFloatMaker : BlockMaker
         int vlen      = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::complex_to_float::make(vlen);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t vlen = info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { vlen * sizeof(gr_complex) };
+        sizes.outputs = { vlen * sizeof(float), vlen * sizeof(float) };
+        return true;
+    }
 };
 
 struct FloatToComplexMaker : BlockMaker
@@ -279,6 +487,19 @@ struct FloatToComplexMaker : BlockMaker
         int vlen      = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::float_to_complex::make(vlen);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t vlen = info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { vlen * sizeof(float), vlen * sizeof(float) };
+        sizes.outputs = { vlen * sizeof(gr_complex) };
+        return true;
+    }
 };
 
 struct SigSourceMaker : BlockMaker
@@ -309,6 +530,25 @@ struct SigSourceMaker : BlockMaker
 
 		return gr::analog::sig_source_f::make(sampling_freq, waveform_type, wave_freq, ampl, offset);
 	}
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        std::vector<std::string> waveforms;
+        for (const auto &waveform : enum_repr) {
+            waveforms.push_back(waveform.first);
+        }
+        return { {"samp_rate", ParamKind::EXPRESSION},
+                {"freq", ParamKind::EXPRESSION},
+                {"amp", ParamKind::EXPRESSION},
+                {"offset", ParamKind::EXPRESSION},
+                {"waveform", ParamKind::TEXT, waveforms} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        sizes.outputs = { sizeof(float) };
+        return true;
+    }
 };
 
 struct ThrottleMaker : BlockMaker
@@ -322,6 +562,21 @@ struct ThrottleMaker : BlockMaker
         auto ignore_tags = info.param_value<bool>("ignoretag");
         return gr::blocks::throttle::make(getSizeOfType(type), samples_per_sec, ignore_tags);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"samples_per_second", ParamKind::EXPRESSION},
+                {"ignoretag", ParamKind::BOOL} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t item_size = getSizeOfType(info.param_value<>("type"));
+        sizes.inputs = { item_size };
+        sizes.outputs = { item_size };
+        return true;
+    }
 };
 
 struct TagShareMaker : BlockMaker
@@ -335,6 +590,23 @@ struct TagShareMaker : BlockMaker
         auto vlen = info.eval_param_value<int>("vlen", variables);
         return gr::blocks::tag_share::make(getSizeOfType(io_type), getSizeOfType(share_type), vlen);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"io_type", ParamKind::TEXT, stream_types},
+                {"share_type", ParamKind::TEXT, stream_types},
+                {"vlen", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        size_t vlen = info.eval_param_value<int>("vlen", variables);
+        size_t io_size = getSizeOfType(info.param_value<>("io_type")) * vlen;
+        size_t share_size = getSizeOfType(info.param_value<>("share_type")) * vlen;
+        sizes.inputs = { io_size, share_size };
+        sizes.outputs = { io_size };
+        return true;
+    }
 };
 
 struct TagDebugMaker : BlockMaker
@@ -353,6 +625,23 @@ struct TagDebugMaker : BlockMaker
         block->set_display(display);
         return block;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"type", ParamKind::TEXT, stream_types},
+                {"name", ParamKind::TEXT},
+                {"filter", ParamKind::TEXT},
+                {"vlen", ParamKind::EXPRESSION},
+                {"display", ParamKind::BOOL} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto item_size = getSizeOfType(info.param_value<>("type")) * info.eval_param_value<int>("vlen", variables);
+        sizes.inputs = { static_cast<size_t>(item_size) };
+        sizes.open_inputs = true;
+        return true;
+    }
 };
 
 // digitizer blocks
@@ -378,6 +667,25 @@ struct AggregationMaker : BlockMaker
 
      return block;
   }
+
+  bool transfer_state() const override
+  {
+      return true;
+  }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"alg_id", ParamKind::EXPRESSION},
+              {"decim", ParamKind::EXPRESSION},
+              {"delay", ParamKind::EXPRESSION},
+              {"fir_taps", ParamKind::VECTOR},
+              {"low_freq", ParamKind::EXPRESSION},
+              {"up_freq", ParamKind::EXPRESSION},
+              {"tr_width", ParamKind::EXPRESSION},
+              {"fb_user_taps", ParamKind::VECTOR},
+              {"fw_user_taps", ParamKind::VECTOR},
+              {"samp_rate", ParamKind::EXPRESSION} };
+  }
 };
 
 struct AmplitudeAndPhaseMaker : BlockMaker
@@ -397,6 +705,22 @@ struct AmplitudeAndPhaseMaker : BlockMaker
 
      return block;
   }
+
+  bool transfer_state() const override
+  {
+      return true;
+  }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"samp_rate", ParamKind::EXPRESSION},
+              {"delay", ParamKind::EXPRESSION},
+              {"decim", ParamKind::EXPRESSION},
+              {"gain", ParamKind::EXPRESSION},
+              {"cutoff", ParamKind::EXPRESSION},
+              {"tr_width", ParamKind::EXPRESSION},
+              {"hil_win", ParamKind::EXPRESSION} };
+  }
 };
 
 struct FrequencyEstimatorMaker : BlockMaker
@@ -413,6 +737,19 @@ struct FrequencyEstimatorMaker : BlockMaker
 
      return block;
   }
+
+  bool transfer_state() const override
+  {
+      return true;
+  }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"samp_rate", ParamKind::EXPRESSION},
+              {"sig_window_size", ParamKind::EXPRESSION},
+              {"freq_window_size", ParamKind::EXPRESSION},
+              {"decim", ParamKind::EXPRESSION} };
+  }
 };
 
 struct ComplexToMagDegMaker : BlockMaker
@@ -423,6 +760,11 @@ struct ComplexToMagDegMaker : BlockMaker
         auto vec_size = info.eval_param_value<int>("vec_size", variables);
         return gr::digitizers::block_complex_to_mag_deg::make(vec_size);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"vec_size", ParamKind::EXPRESSION} };
+    }
 };
 
 struct DemuxMaker : BlockMaker
@@ -437,6 +779,11 @@ struct DemuxMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"bit_to_keep", ParamKind::EXPRESSION} };
+  }
 };
 
 struct ScalingOffsetMaker : BlockMaker
@@ -452,6 +799,12 @@ struct ScalingOffsetMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"scale", ParamKind::EXPRESSION},
+              {"offset", ParamKind::EXPRESSION} };
+  }
 };
 
 struct SpectralPeaksMaker : BlockMaker
@@ -470,6 +823,20 @@ struct SpectralPeaksMaker : BlockMaker
 
      return block;
   }
+
+  bool transfer_state() const override
+  {
+      return true;
+  }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"samp_rate", ParamKind::EXPRESSION},
+              {"fft_win", ParamKind::EXPRESSION},
+              {"med_n", ParamKind::EXPRESSION},
+              {"avg_n", ParamKind::EXPRESSION},
+              {"prox_n", ParamKind::EXPRESSION} };
+  }
 };
 
 struct CascadeSinkMaker : BlockMaker
@@ -518,6 +885,29 @@ struct CascadeSinkMaker : BlockMaker
                                                   post_samples);
 
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"alg_id", ParamKind::EXPRESSION},
+                {"delay", ParamKind::EXPRESSION},
+                {"fir_taps", ParamKind::VECTOR},
+                {"low_freq", ParamKind::EXPRESSION},
+                {"up_freq", ParamKind::EXPRESSION},
+                {"tr_width", ParamKind::EXPRESSION},
+                {"fb_user_taps", ParamKind::VECTOR},
+                {"fw_user_taps", ParamKind::VECTOR},
+                {"samp_rate", ParamKind::EXPRESSION},
+                {"pm_buffer", ParamKind::EXPRESSION},
+                {"signal_name", ParamKind::TEXT},
+                {"signal_unit", ParamKind::TEXT},
+                {"streaming_sinks_enabled", ParamKind::BOOL},
+                {"triggered_sinks_enabled", ParamKind::BOOL},
+                {"frequency_sinks_enabled", ParamKind::BOOL},
+                {"postmortem_sinks_enabled", ParamKind::BOOL},
+                {"interlocks_enabled", ParamKind::BOOL},
+                {"pre_trigger_samples_raw", ParamKind::EXPRESSION},
+                {"post_trigger_samples_raw", ParamKind::EXPRESSION} };
+    }
 };
 struct ChiSquareFitMaker : BlockMaker
 {
@@ -543,6 +933,22 @@ struct ChiSquareFitMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"num_samps", ParamKind::EXPRESSION},
+              {"function", ParamKind::TEXT},
+              {"fun_u", ParamKind::EXPRESSION},
+              {"fun_l", ParamKind::EXPRESSION},
+              {"num_params", ParamKind::EXPRESSION},
+              {"par_names", ParamKind::TEXT},
+              {"param_init", ParamKind::VECTOR},
+              {"param_err", ParamKind::VECTOR},
+              {"param_fit", ParamKind::VECTOR},
+              {"par_sp_l", ParamKind::VECTOR},
+              {"par_sp_u", ParamKind::VECTOR},
+              {"chi_sq", ParamKind::EXPRESSION} };
+  }
 };
 
 struct DecimateAndAdjustTimebaseMaker : BlockMaker
@@ -559,6 +965,13 @@ struct DecimateAndAdjustTimebaseMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"decimation", ParamKind::EXPRESSION},
+              {"delay", ParamKind::EXPRESSION},
+              {"samp_rate", ParamKind::EXPRESSION} };
+  }
 };
 
 struct EdgeTriggerMaker : BlockMaker
@@ -578,6 +991,17 @@ struct EdgeTriggerMaker : BlockMaker
         auto block =  gr::digitizers::edge_trigger_ff::make(sampling, lo, hi, initial_satate, send_udp, host_list, timeout);
         return block;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"sampling", ParamKind::EXPRESSION},
+                {"timeout", ParamKind::EXPRESSION},
+                {"lo", ParamKind::EXPRESSION},
+                {"hi", ParamKind::EXPRESSION},
+                {"initial_state", ParamKind::EXPRESSION},
+                {"send_udp", ParamKind::BOOL},
+                {"host_list", ParamKind::TEXT} };
+    }
 };
 
 struct EdgeTriggerReceiverMaker : BlockMaker
@@ -589,6 +1013,12 @@ struct EdgeTriggerReceiverMaker : BlockMaker
         auto port = info.eval_param_value<int>("port", variables);
         return gr::digitizers::edge_trigger_receiver_f::make(addr, port);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"addr", ParamKind::TEXT},
+                {"port", ParamKind::EXPRESSION} };
+    }
 };
 
 
@@ -604,6 +1034,12 @@ struct ExtractorMaker : BlockMaker
 
       return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"pre_trigger_window", ParamKind::EXPRESSION},
+              {"post_trigger_window", ParamKind::EXPRESSION} };
+  }
 };
 
 struct FreqSinkMaker : BlockMaker
@@ -624,6 +1060,16 @@ struct FreqSinkMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"acquisition_type", ParamKind::EXPRESSION},
+              {"signal_name", ParamKind::TEXT},
+              {"samp_rate", ParamKind::EXPRESSION},
+              {"nbins", ParamKind::EXPRESSION},
+              {"nmeasurements", ParamKind::EXPRESSION},
+              {"nbuffers", ParamKind::EXPRESSION} };
+  }
 };
 
 struct FunctionMaker : BlockMaker
@@ -644,6 +1090,15 @@ struct FunctionMaker : BlockMaker
 
         return block;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"decimation", ParamKind::EXPRESSION},
+                {"time", ParamKind::VECTOR},
+                {"reference", ParamKind::VECTOR},
+                {"min", ParamKind::VECTOR},
+                {"max", ParamKind::VECTOR} };
+    }
 };
 
 struct InterlockGenerationMaker : BlockMaker
@@ -659,6 +1114,12 @@ struct InterlockGenerationMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"max_max", ParamKind::EXPRESSION},
+              {"max_min", ParamKind::EXPRESSION} };
+  }
 };
 
 struct Ps3000aMaker : BlockMaker
@@ -678,6 +1139,9 @@ struct Ps3000aMaker : BlockMaker
         if (acquisition_mode == "Streaming") {
             auto_arm = false; // otehrwise lost samples during startup
         }
+        if (info.is_param_set("auto_arm")) {
+            auto_arm = info.param_value<bool>("auto_arm"); // see BuildOptions::sequenced_start
+        }
         auto ps = gr::digitizers::picoscope_3000a::make(serial_number, auto_arm);
         ps->set_trigger_once(trigger_once);
         ps->set_samp_rate(samp_rate);
@@ -765,6 +1229,11 @@ struct Ps3000aMaker : BlockMaker
         }
         return ps;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return picoscope_parameters(info, "abcd", true, true);
+    }
 };
 
 struct Ps4000aMaker : BlockMaker
@@ -784,6 +1253,9 @@ struct Ps4000aMaker : BlockMaker
         if (acquisition_mode == "Streaming") {
             auto_arm = false; // otehrwise lost samples during startup
         }
+        if (info.is_param_set("auto_arm")) {
+            auto_arm = info.param_value<bool>("auto_arm"); // see BuildOptions::sequenced_start
+        }
         auto ps = gr::digitizers::picoscope_4000a::make(serial_number, auto_arm);
         ps->set_trigger_once(trigger_once);
         ps->set_samp_rate(samp_rate);
@@ -896,6 +1368,11 @@ struct Ps4000aMaker : BlockMaker
         }
         return ps;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return picoscope_parameters(info, "abcdefgh", false, true);
+    }
 };
 
 struct Ps6000Maker : BlockMaker
@@ -915,6 +1392,9 @@ struct Ps6000Maker : BlockMaker
         if (acquisition_mode == "Streaming") {
             auto_arm = false; // otehrwise lost samples during startup
         }
+        if (info.is_param_set("auto_arm")) {
+            auto_arm = info.param_value<bool>("auto_arm"); // see BuildOptions::sequenced_start
+        }
         auto ps = gr::digitizers::picoscope_6000::make(serial_number, auto_arm);
         ps->set_trigger_once(trigger_once);
         ps->set_samp_rate(samp_rate);
@@ -985,6 +1465,11 @@ struct Ps6000Maker : BlockMaker
         }
         return ps;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return picoscope_parameters(info, "abcd", false, false);
+    }
 };
 
 struct PostMortemSinkMaker : BlockMaker
@@ -1001,6 +1486,14 @@ struct PostMortemSinkMaker : BlockMaker
         auto sink =  gr::digitizers::post_mortem_sink::make(signal_name, signal_unit, samp_rate, buffer_size);
         return sink;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"signal_name", ParamKind::TEXT},
+                {"signal_unit", ParamKind::TEXT},
+                {"samp_rate", ParamKind::EXPRESSION},
+                {"buffer_size", ParamKind::INTEGER} };
+    }
 };
 
 struct SignalAveragerMaker : BlockMaker
@@ -1017,6 +1510,18 @@ struct SignalAveragerMaker : BlockMaker
 
      return block;
   }
+
+  bool transfer_state() const override
+  {
+      return true;
+  }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"window_size", ParamKind::EXPRESSION},
+              {"n_ports", ParamKind::EXPRESSION},
+              {"samp_rate", ParamKind::EXPRESSION} };
+  }
 };
 
 struct StftAlgorithmsMaker : BlockMaker
@@ -1038,6 +1543,18 @@ struct StftAlgorithmsMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"samp_rate", ParamKind::EXPRESSION},
+              {"delta_t", ParamKind::EXPRESSION},
+              {"alg_id", ParamKind::EXPRESSION},
+              {"win_size", ParamKind::EXPRESSION},
+              {"win_type", ParamKind::WINDOW},
+              {"fq_low", ParamKind::EXPRESSION},
+              {"fq_hi", ParamKind::EXPRESSION},
+              {"nbins", ParamKind::EXPRESSION} };
+  }
 };
 
 struct StftGoertzlDynamicMaker : BlockMaker
@@ -1056,6 +1573,15 @@ struct StftGoertzlDynamicMaker : BlockMaker
 
      return block;
   }
+
+  std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+  {
+      return { {"samp_rate", ParamKind::EXPRESSION},
+              {"delta_t", ParamKind::EXPRESSION},
+              {"win_size", ParamKind::EXPRESSION},
+              {"nbins", ParamKind::EXPRESSION},
+              {"bound_decim", ParamKind::EXPRESSION} };
+  }
 };
 
 struct TimeDomainSinkMaker : BlockMaker
@@ -1077,6 +1603,17 @@ struct TimeDomainSinkMaker : BlockMaker
         else
             return gr::digitizers::time_domain_sink::make(signal_name, signal_unit, samp_rate, static_cast<gr::digitizers::time_sink_mode_t>(mode), (size_t)output_package_size);
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"signal_name", ParamKind::TEXT},
+                {"signal_unit", ParamKind::TEXT},
+                {"samp_rate", ParamKind::EXPRESSION},
+                {"output_package_size", ParamKind::EXPRESSION},
+                {"pre_samples", ParamKind::EXPRESSION},
+                {"post_samples", ParamKind::EXPRESSION},
+                {"acquisition_type", ParamKind::INTEGER} };
+    }
 };
 
 struct TimeRealignmentMaker : BlockMaker
@@ -1092,6 +1629,13 @@ struct TimeRealignmentMaker : BlockMaker
         auto block =  gr::digitizers::time_realignment_ff::make(info.id, user_delay, triggerstamp_matching_tolerance, max_buffer_time);
         return block;
     }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"user_delay", ParamKind::EXPRESSION},
+                {"triggerstamp_matching_tolerance", ParamKind::EXPRESSION},
+                {"max_buffer_time", ParamKind::EXPRESSION} };
+    }
 };
 
 struct WrReceiverMaker : BlockMaker
@@ -1114,6 +1658,13 @@ struct AmplitudePhaseAdjusterMaker : BlockMaker
                 float phi_fq_usr = info.eval_param_value<float>("phi_fq_usr", variables);
                 return gr::digitizers::amplitude_phase_adjuster::make(ampl_cal, phi_usr, phi_fq_usr);
             }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"ampl_cal", ParamKind::EXPRESSION},
+                {"phi_usr", ParamKind::EXPRESSION},
+                {"phi_fq_usr", ParamKind::EXPRESSION} };
+    }
 };
 
 static std::vector<float> makeBandPassFilterFloat(const BlockInfo &info, const std::vector<BlockInfo> &variables)
@@ -1227,6 +1778,28 @@ struct FreqXlatingFirFilterMaker : BlockMaker
             throw std::invalid_argument(message.str());
         }
     }
+
+    bool transfer_state() const override
+    {
+        return true;
+    }
+
+    std::vector<ParamSpec> parameters(const BlockInfo &info) const override
+    {
+        return { {"decim", ParamKind::EXPRESSION},
+                {"type", ParamKind::TEXT, {"ccc", "ccf", "fcc", "fcf", "scc", "scf"}},
+                {"taps", ParamKind::VARIABLE},
+                {"center_freq", ParamKind::EXPRESSION},
+                {"samp_rate", ParamKind::EXPRESSION} };
+    }
+
+    bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const override
+    {
+        auto input_type = info.param_value("type").at(0);
+        sizes.inputs = { input_type == 'c' ? sizeof(gr_complex) : input_type == 's' ? sizeof(short) : sizeof(float) };
+        sizes.outputs = { sizeof(gr_complex) };
+        return true;
+    }
 };
 
 
@@ -1279,14 +1852,16 @@ BlockFactory::BlockFactory()
 
 
 /*!
- * Affinity is not parsed as a vector for now...
+ * Hierarchical blocks pass the affinity on to their internal blocks.
  */
 void BlockFactory::common_settings(gr::basic_block_sptr block,
         const BlockInfo &info, const std::vector<BlockInfo> &variables)
 {
     if (info.is_param_set("affinity")) {
-        auto affinity = info.param_value<int>("affinity");
-        block->set_processor_affinity(std::vector<int> {affinity});
+        auto affinity = parse_cpu_list(info.param_value("affinity"));
+        if (!affinity.empty()) {
+            block->set_processor_affinity(affinity);
+        }
     }
 
     if (info.is_param_set("minoutbuf")) {
@@ -1322,6 +1897,46 @@ void BlockFactory::common_settings(gr::basic_block_sptr block,
             }
         }
     }
+
+    if (info.is_param_set("max_noutput_items")) {
+        auto max_noutput_items = info.eval_param_value<int>("max_noutput_items", variables);
+        if (max_noutput_items > 0) {
+            gr::block_sptr blk_ptr = boost::dynamic_pointer_cast<gr::block>(block);
+            if (blk_ptr) {
+                blk_ptr->set_max_noutput_items(max_noutput_items);
+            }
+            else {
+                std::cerr << "cannot set max_noutput_items parameter!\n";
+            }
+        }
+    }
+}
+
+std::vector<ParamSpec> BlockFactory::common_parameters(const BlockInfo &info)
+{
+    std::vector<ParamSpec> params;
+    if (info.is_param_set("affinity")) {
+        params.push_back(ParamSpec("affinity", ParamKind::CPU_LIST));
+    }
+    if (info.is_param_set("minoutbuf")) {
+        params.push_back(ParamSpec("minoutbuf", ParamKind::EXPRESSION));
+    }
+    if (info.is_param_set("maxoutbuf")) {
+        params.push_back(ParamSpec("maxoutbuf", ParamKind::EXPRESSION));
+    }
+    if (info.is_param_set("max_noutput_items")) {
+        params.push_back(ParamSpec("max_noutput_items", ParamKind::EXPRESSION));
+    }
+    if (info.is_param_set("latency_class")) {
+        params.push_back(ParamSpec("latency_class", ParamKind::TEXT, {"low", "throughput"}));
+    }
+    if (info.is_param_set("priority")) {
+        params.push_back(ParamSpec("priority", ParamKind::PRIORITY));
+    }
+    if (info.is_param_set("shed_order")) {
+        params.push_back(ParamSpec("shed_order", ParamKind::EXPRESSION));
+    }
+    return params;
 }
 
 gr::basic_block_sptr BlockFactory::make_block(const BlockInfo &info, const std::vector<BlockInfo> &variables)
@@ -1343,54 +1958,2016 @@ gr::basic_block_sptr BlockFactory::make_block(const BlockInfo &info, const std::
     return block;
 }
 
-std::unique_ptr<FlowGraph> make_flowgraph(std::istream &input)
+/*!
+ * Sample rate at the outputs of a block, given the rate at its inputs. Returns 0
+ * if the rate is unknown.
+ */
+static double block_output_rate(const BlockInfo &info, double input_rate, const std::vector<BlockInfo> &variables)
 {
-	// parse input and replace variables
-	flowgraph::GrcParser parser(input);
-	parser.parse();
-	parser.collapse_variables();
-
-	// obtain title if provided
-	std::string title = parser.top_block().param_value("title");
-	if (!title.length())
-	{
-		title = "My Flowgraph";
-	}
-
-	// make graph, add blocks and connections
-	BlockFactory factory;
+    double rate = input_rate;
+    if (info.is_param_set("samp_rate")) {
+        rate = info.eval_param_value<double>("samp_rate", variables);
+    }
+    else if (info.is_param_set("samples_per_second")) {
+        rate = info.eval_param_value<double>("samples_per_second", variables);
+    }
 
-	std::unique_ptr<FlowGraph> graph(new FlowGraph(title));
+    if (rate <= 0.0) {
+        return 0.0;
+    }
 
-	auto variables = parser.variables();
-	std::vector<std::string> disabled_blocks;
- 	for (auto info : parser.blocks())
- 	{
- 	    if (!info.param_value<bool>("_enabled")) {
- 	        disabled_blocks.push_back(info.id);
- 	        continue;
- 	    }
+    double decimation = 1.0;
+    if (info.key == blocks_stream_to_vector_key) {
+        decimation = info.eval_param_value<double>("num_items", variables);
+    }
+    else if (info.key == blocks_vector_to_stream_key) {
+        decimation = 1.0 / info.eval_param_value<double>("num_items", variables);
+    }
+    else if (std::find(digitizer_keys.begin(), digitizer_keys.end(), info.key) != digitizer_keys.end()) {
+        if (info.param_value<int>("downsampling_mode") != 0) {
+            decimation = info.eval_param_value<double>("downsampling_factor", variables);
+        }
+    }
+    else if (info.is_param_set("delta_t")) {
+        // STFT blocks emit one spectrum every delta_t seconds
+        return 1.0 / info.eval_param_value<double>("delta_t", variables);
+    }
+    else if (info.is_param_set("decim")) {
+        decimation = info.eval_param_value<double>("decim", variables);
+    }
+    else if (info.is_param_set("decimation")) {
+        decimation = info.eval_param_value<double>("decimation", variables);
+    }
+
+    return decimation > 0.0 ? rate / decimation : 0.0;
+}
+
+std::map<std::string, double> propagate_sample_rates(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables)
+{
+    std::map<std::string, double> rates;
+
+    // flowgraphs are acyclic, after as many passes as there are blocks all rates are settled
+    for (size_t pass = 0; pass < blocks.size(); pass++) {
+        bool changed = false;
+
+        for (const auto &block : blocks) {
+            double input_rate = 0.0;
+            for (const auto &con : connections) {
+                auto src = rates.find(con.src_id);
+                if (con.dst_id == block.id && src != rates.end()) {
+                    input_rate = std::max(input_rate, src->second);
+                }
+            }
+
+            double rate = 0.0;
+            try {
+                rate = block_output_rate(block, input_rate, variables);
+            }
+            catch (...) {
+                // malformed parameters are reported once the block is made
+            }
+
+            auto it = rates.find(block.id);
+            if (rate > 0.0 && (it == rates.end() || it->second != rate)) {
+                rates[block.id] = rate;
+                changed = true;
+            }
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+
+    return rates;
+}
+
+std::map<std::string, std::pair<std::string, bool>> assign_latency_classes(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections)
+{
+    std::map<std::string, std::pair<std::string, bool>> classes;
+
+    for (const auto &info : blocks) {
+        if (info.is_param_set("latency_class")) {
+            classes[info.id] = std::make_pair(info.param_value("latency_class"), false);
+        }
+        else if (info.key == interlock_generation_ff_key) {
+            classes[info.id] = std::make_pair(std::string("low"), false);
+        }
+    }
+
+    // flowgraphs are acyclic, after as many passes as there are blocks all classes are settled
+    for (size_t pass = 0; pass < blocks.size(); pass++) {
+        bool changed = false;
+
+        for (const auto &info : blocks) {
+            if (classes.count(info.id)) {
+                continue;
+            }
+
+            bool has_consumers = false, all_low = true;
+            for (const auto &con : connections) {
+                if (con.src_id == info.id) {
+                    has_consumers = true;
+                    auto it = classes.find(con.dst_id);
+                    all_low = all_low && it != classes.end() && it->second.first == "low";
+                }
+            }
+
+            if (has_consumers && all_low) {
+                classes[info.id] = std::make_pair(std::string("low"), true);
+                changed = true;
+            }
+        }
+
+        if (!changed) {
+            break;
+        }
+    }
+
+    for (const auto &info : blocks) {
+        if (!classes.count(info.id)) {
+            classes[info.id] = std::make_pair(std::string("throughput"), true);
+        }
+    }
+
+    return classes;
+}
+
+std::vector<int> parse_cpu_list(const std::string &value)
+{
+    std::vector<int> cpus;
+    std::vector<std::string> items;
+    auto list = boost::algorithm::trim_copy_if(value, boost::algorithm::is_any_of("[]() \t\n"));
+    boost::algorithm::split(items, list, boost::algorithm::is_any_of(","));
+
+    for (auto item : items) {
+        boost::algorithm::trim(item);
+        if (item.empty()) {
+            continue;
+        }
+
+        try {
+            auto dash = item.find('-', 1);
+            int first = boost::lexical_cast<int>(boost::algorithm::trim_copy(item.substr(0, dash)));
+            int last = dash == std::string::npos ? first
+                    : boost::lexical_cast<int>(boost::algorithm::trim_copy(item.substr(dash + 1)));
+            if (first < 0 || last < first) {
+                throw boost::bad_lexical_cast();
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        catch (const boost::bad_lexical_cast &) {
+            std::ostringstream message;
+            message << "Exception in " << __FILE__ << ":" << __LINE__ << ": invalid CPU list: " << value;
+            throw std::invalid_argument(message.str());
+        }
+    }
+
+    return cpus;
+}
+
+ThreadPriority parse_thread_priority(const std::string &value)
+{
+    ThreadPriority priority;
+    auto text = boost::algorithm::trim_copy(value);
+    auto colon = text.find(':');
+    auto policy = colon == std::string::npos ? std::string("fifo")
+            : boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(text.substr(0, colon)));
+
+    try {
+        priority.value = boost::lexical_cast<int>(boost::algorithm::trim_copy(
+                colon == std::string::npos ? text : text.substr(colon + 1)));
+    }
+    catch (const boost::bad_lexical_cast &) {
+        policy.clear();
+    }
+
+    if (policy == "fifo") {
+        priority.policy = ThreadPriority::FIFO;
+    }
+    else if (policy == "rr") {
+        priority.policy = ThreadPriority::RR;
+    }
+    else if (policy == "nice") {
+        priority.policy = ThreadPriority::NICE;
+    }
+    else {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__
+                << ": invalid priority, expected fifo:N, rr:N or nice:N: " << value;
+        throw std::invalid_argument(message.str());
+    }
+
+    return priority;
+}
+
+std::vector<int> read_cpu_list(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line)) {
+        return std::vector<int>();
+    }
+    return parse_cpu_list(line);
+}
+
+/*!
+ * Index of the group of connected blocks each block belongs to, numbered in the
+ * order of the blocks.
+ */
+static std::map<std::string, int> connected_components(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections)
+{
+    std::map<std::string, int> component;
+    int components = 0;
+
+    for (const auto &info : blocks) {
+        if (component.count(info.id)) {
+            continue;
+        }
+        std::vector<std::string> pending(1, info.id);
+        component[info.id] = components;
+        while (!pending.empty()) {
+            auto id = pending.back();
+            pending.pop_back();
+            for (const auto &con : connections) {
+                const std::string *other = con.src_id == id ? &con.dst_id : con.dst_id == id ? &con.src_id : nullptr;
+                if (other && !component.count(*other)) {
+                    component[*other] = components;
+                    pending.push_back(*other);
+                }
+            }
+        }
+        components++;
+    }
+
+    return component;
+}
+
+static std::vector<int> online_cpus()
+{
+    auto cpus = read_cpu_list("/sys/devices/system/cpu/online");
+    if (cpus.empty()) {
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> pinning_cpus()
+{
+    auto cpus = read_cpu_list("/sys/devices/system/cpu/isolated");
+    return cpus.empty() ? online_cpus() : cpus;
+}
+
+std::vector<NumaNode> numa_nodes()
+{
+    std::vector<NumaNode> nodes;
+    for (int node : read_cpu_list("/sys/devices/system/node/online")) {
+        std::ostringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        auto cpus = read_cpu_list(path.str());
+        // memory only nodes can't run blocks
+        if (!cpus.empty()) {
+            nodes.push_back(NumaNode{node, cpus});
+        }
+    }
+
+    if (nodes.empty()) {
+        nodes.push_back(NumaNode{0, online_cpus()});
+    }
+    return nodes;
+}
+
+// divisors a group of blocks goes through while it is shed
+static const std::vector<int> shedding_divisors = {1, 2, 4, 0};
+
+static std::vector<int> shedding_groups(const std::map<std::string, int> &orders)
+{
+    std::set<int> groups;
+    for (const auto &entry : orders) {
+        groups.insert(entry.second);
+    }
+    return std::vector<int>(groups.begin(), groups.end());
+}
+
+size_t load_shedding_steps(const std::map<std::string, int> &orders)
+{
+    return shedding_groups(orders).size() * (shedding_divisors.size() - 1);
+}
+
+std::map<std::string, int> plan_load_shedding(const std::map<std::string, int> &orders, size_t step)
+{
+    auto groups = shedding_groups(orders);
+    size_t levels = shedding_divisors.size() - 1;
+
+    std::map<std::string, int> plan;
+    for (const auto &entry : orders) {
+        size_t group = std::find(groups.begin(), groups.end(), entry.second) - groups.begin();
+        size_t first = group * levels;
+        size_t level = step > first ? std::min(step - first, levels) : 0;
+        plan[entry.first] = shedding_divisors[level];
+    }
+    return plan;
+}
+
+std::map<std::string, int> plan_numa_nodes(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::map<std::string, double> &load,
+        const std::vector<NumaNode> &nodes)
+{
+    std::map<std::string, int> plan;
+    if (nodes.empty()) {
+        return plan;
+    }
+
+    auto component = connected_components(blocks, connections);
+    int components = 0;
+    for (const auto &entry : component) {
+        components = std::max(components, entry.second + 1);
+    }
+
+    // a block with an explicit affinity, e.g. the digitizer, draws its group to its node
+    std::vector<double> component_load(components, 0.0);
+    std::vector<int> component_node(components, -1);
+    for (const auto &info : blocks) {
+        int c = component.at(info.id);
+        auto it = load.find(info.id);
+        if (it != load.end()) {
+            component_load[c] += it->second;
+        }
+
+        if (component_node[c] < 0 && info.is_param_set("affinity")) {
+            auto affinity = parse_cpu_list(info.param_value("affinity"));
+            for (size_t n = 0; n < nodes.size() && !affinity.empty(); n++) {
+                if (std::find(nodes[n].cpus.begin(), nodes[n].cpus.end(), affinity[0]) != nodes[n].cpus.end()) {
+                    component_node[c] = n;
+                }
+            }
+        }
+    }
+
+    std::vector<double> node_load(nodes.size(), 0.0);
+    for (int c = 0; c < components; c++) {
+        if (component_node[c] >= 0) {
+            node_load[component_node[c]] += component_load[c];
+        }
+    }
+
+    // the remaining groups go to the least loaded node, the heaviest first
+    std::vector<int> order;
+    for (int c = 0; c < components; c++) {
+        if (component_node[c] < 0) {
+            order.push_back(c);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+            [&component_load](int a, int b) { return component_load[a] > component_load[b]; });
+
+    for (int c : order) {
+        auto node = std::min_element(node_load.begin(), node_load.end()) - node_load.begin();
+        component_node[c] = node;
+        node_load[node] += component_load[c];
+    }
+
+    for (const auto &info : blocks) {
+        plan[info.id] = nodes[component_node[component.at(info.id)]].node;
+    }
+    return plan;
+}
+
+std::vector<std::vector<int>> cache_domains(const std::vector<int> &cpus)
+{
+    std::vector<std::vector<int>> domains;
+    std::set<int> assigned;
+
+    for (int cpu : cpus) {
+        if (assigned.count(cpu)) {
+            continue;
+        }
+
+        // the cache index with the highest level is the last level cache
+        std::vector<int> shared;
+        int last_level = 0;
+        for (int index = 0; ; index++) {
+            std::ostringstream dir;
+            dir << "/sys/devices/system/cpu/cpu" << cpu << "/cache/index" << index << "/";
+            std::ifstream level_file(dir.str() + "level");
+            int level;
+            if (!(level_file >> level)) {
+                break;
+            }
+            if (level > last_level) {
+                last_level = level;
+                shared = read_cpu_list(dir.str() + "shared_cpu_list");
+            }
+        }
+
+        std::vector<int> domain;
+        for (int other : cpus) {
+            if (other == cpu || (!assigned.count(other) && std::find(shared.begin(), shared.end(), other) != shared.end())) {
+                domain.push_back(other);
+                assigned.insert(other);
+            }
+        }
+        domains.push_back(domain);
+    }
+
+    return domains;
+}
+
+/*!
+ * Blocks in the order of the data path: depth first from the sources, so that
+ * the blocks of a chain follow each other.
+ */
+static std::vector<std::string> data_path_order(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections)
+{
+    std::vector<std::string> order;
+    std::set<std::string> visited;
+
+    std::function<void(const std::string &)> visit = [&](const std::string &id) {
+        if (!visited.insert(id).second) {
+            return;
+        }
+        order.push_back(id);
+        for (const auto &con : connections) {
+            if (con.src_id == id) {
+                visit(con.dst_id);
+            }
+        }
+    };
+
+    for (const auto &info : blocks) {
+        bool source = std::none_of(connections.begin(), connections.end(),
+                [&info](const ConnectionInfo &con) { return con.dst_id == info.id; });
+        if (source) {
+            visit(info.id);
+        }
+    }
+    for (const auto &info : blocks) {
+        visit(info.id);
+    }
+
+    return order;
+}
+
+std::map<std::string, std::vector<int>> plan_affinity(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::set<std::string> &hierarchical,
+        PinningPolicy policy, const std::vector<int> &cpus, const std::vector<std::vector<int>> &domains)
+{
+    std::map<std::string, std::vector<int>> plan;
+    if (policy == PinningPolicy::NONE || cpus.empty()) {
+        return plan;
+    }
+
+    std::set<std::string> explicit_affinity;
+    for (const auto &info : blocks) {
+        if (info.is_param_set("affinity") && !parse_cpu_list(info.param_value("affinity")).empty()) {
+            explicit_affinity.insert(info.id);
+        }
+    }
+
+    if (policy == PinningPolicy::SHARED_CACHE) {
+        auto cache = domains.empty() ? std::vector<std::vector<int>>(1, cpus) : domains;
+
+        auto component = connected_components(blocks, connections);
+        for (const auto &info : blocks) {
+            if (!explicit_affinity.count(info.id)) {
+                plan[info.id] = cache[component[info.id] % cache.size()];
+            }
+        }
+        return plan;
+    }
+
+    std::vector<std::string> order;
+    if (policy == PinningPolicy::CHAIN) {
+        order = data_path_order(blocks, connections);
+    }
+    else {
+        for (const auto &info : blocks) {
+            order.push_back(info.id);
+        }
+    }
+
+    size_t next = 0;
+    for (const auto &id : order) {
+        if (explicit_affinity.count(id)) {
+            continue;
+        }
+        if (hierarchical.count(id)) {
+            plan[id] = cpus;
+        }
+        else {
+            plan[id] = std::vector<int>(1, cpus[next++ % cpus.size()]);
+        }
+    }
+
+    return plan;
+}
+
+long round_to_pages(long nitems, size_t item_size, long page_size)
+{
+    if (item_size == 0 || page_size <= 0) {
+        return nitems;
+    }
+
+    // smallest number of items spanning a whole number of pages
+    long a = static_cast<long>(item_size), b = page_size;
+    while (b) {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    long granularity = page_size / a;
+
+    return ((nitems + granularity - 1) / granularity) * granularity;
+}
+
+long planned_buffer_items(double samp_rate, double target_latency, long needed, size_t item_size, long page_size)
+{
+    long nitems = std::max(needed, static_cast<long>(std::ceil(samp_rate * target_latency)));
+    return round_to_pages(nitems, item_size, page_size);
+}
+
+GraphInfo enabled_graph(const GraphInfo &graph)
+{
+    GraphInfo enabled;
+    enabled.top_block = graph.top_block;
+    enabled.variables = graph.variables;
+
+    std::set<std::string> disabled_blocks;
+    for (const auto &info : graph.blocks) {
+        if (info.param_value<bool>("_enabled")) {
+            enabled.blocks.push_back(info);
+        }
+        else {
+            disabled_blocks.insert(info.id);
+        }
+    }
+
+    // connect only if both ends are enabled
+    for (const auto &info : graph.connections) {
+        if (!disabled_blocks.count(info.src_id) && !disabled_blocks.count(info.dst_id)) {
+            enabled.connections.push_back(info);
+        }
+    }
+
+    return enabled;
+}
+
+// GNU Radio's default stream buffer, see flat_flowgraph::allocate_buffer
+static const long default_buffer_bytes = 2 * 32768;
+
+OutputBufferSetting output_buffer_setting(long nitems, size_t item_size)
+{
+    OutputBufferSetting setting = {0, 0};
+    if (nitems * static_cast<long>(item_size) >= default_buffer_bytes) {
+        setting.minoutbuf = nitems;
+    }
+    else {
+        setting.maxoutbuf = nitems;
+    }
+    return setting;
+}
+
+long allocated_buffer_items(long needed, size_t item_size, long minoutbuf, long maxoutbuf, long page_size)
+{
+    long nitems = std::max(default_buffer_bytes / static_cast<long>(item_size), needed);
+    if (maxoutbuf > 0) {
+        nitems = std::min(nitems, maxoutbuf);
+    }
+    else if (minoutbuf > 0) {
+        nitems = std::max(nitems, minoutbuf);
+    }
+    return round_to_pages(nitems, item_size, page_size);
+}
+
+/*!
+ * Items a reader needs in its input buffer: two work calls including history.
+ */
+static long reader_buffer_items(long history, long per_call)
+{
+    return 2 * (history - 1 + per_call);
+}
+
+/*!
+ * Item size of the output ports of a block, derived from its parameters. Falls
+ * back to float, the type streamed by most digitizer blocks.
+ */
+static size_t estimate_item_size(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    size_t item_size = sizeof(float);
+
+    try {
+        if (info.key == blocks_float_to_complex_key || info.key == freq_xlating_fir_filter_xxx_key) {
+            item_size = sizeof(gr_complex);
+        }
+        else if (info.key == blocks_complex_to_float_key || info.key == blocks_complex_to_mag_key
+                || info.key == blocks_complex_to_magphase_key || info.key == blocks_uchar_to_float_key) {
+            item_size = sizeof(float);
+        }
+        else if (info.is_param_set("type")) {
+            item_size = BlockMaker::getSizeOfType(info.param_value("type"));
+        }
+        else if (info.is_param_set("io_type")) {
+            item_size = BlockMaker::getSizeOfType(info.param_value("io_type"));
+        }
+
+        if (info.is_param_set("vlen")) {
+            item_size *= info.eval_param_value<int>("vlen", variables);
+        }
+        if (info.key == blocks_stream_to_vector_key) {
+            item_size *= info.eval_param_value<int>("num_items", variables);
+        }
+        else if (info.key == stft_algorithms_key || info.key == stft_goertzl_dynamic_key) {
+            item_size *= info.eval_param_value<int>("nbins", variables);
+        }
+    }
+    catch (...) {
+        // unknown type, keep the fallback
+    }
+
+    return item_size;
+}
+
+/*!
+ * Memory of the acquisition buffers kept by sinks. Values and errors are
+ * stored as floats.
+ */
+static size_t estimate_sink_bytes(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    const double sample_bytes = 2 * sizeof(float);
+
+    try {
+        if (info.key == post_mortem_sink_key) {
+            return static_cast<size_t>(info.param_value<int>("buffer_size") * sample_bytes);
+        }
+        else if (info.key == cascade_sink_key) {
+            if (info.param_value<bool>("postmortem_sinks_enabled")) {
+                // pm_buffer is given in seconds of the raw signal
+                auto pm_buffer = info.eval_param_value<double>("pm_buffer", variables);
+                auto samp_rate = info.eval_param_value<double>("samp_rate", variables);
+                return static_cast<size_t>(pm_buffer * samp_rate * sample_bytes);
+            }
+        }
+        else if (info.key == time_domain_sink_key) {
+            if (info.param_value<int>("acquisition_type") == gr::digitizers::time_sink_mode_t::TIME_SINK_MODE_TRIGGERED) {
+                auto pre_samples = info.eval_param_value<int>("pre_samples", variables);
+                auto post_samples = info.eval_param_value<int>("post_samples", variables);
+                return static_cast<size_t>((pre_samples + post_samples) * sample_bytes);
+            }
+            return static_cast<size_t>(info.eval_param_value<size_t>("output_package_size", variables) * sample_bytes);
+        }
+        else if (info.key == freq_sink_f_key) {
+            // magnitude, phase and frequency per bin
+            auto nbins = info.eval_param_value<size_t>("nbins", variables);
+            auto nmeasurements = info.eval_param_value<size_t>("nmeasurements", variables);
+            auto nbuffers = info.eval_param_value<size_t>("nbuffers", variables);
+            return nbins * nmeasurements * nbuffers * 3 * sizeof(float);
+        }
+    }
+    catch (...) {
+        // malformed parameters are reported once the block is made
+    }
+
+    return 0;
+}
+
+/*!
+ * Number of filter taps of a block, 0 if it has no filter or it is not known.
+ */
+static size_t estimate_ntaps(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    try {
+        if (info.is_param_set("fir_taps")) {
+            return info.eval_param_vector<float>("fir_taps", variables).size();
+        }
+        else if (info.key == freq_xlating_fir_filter_xxx_key) {
+            auto taps_name = info.param_value("taps");
+            for (const auto &variable : variables) {
+                if (variable.id == taps_name && variable.key == band_pass_filter_taps_key) {
+                    // firdes designs about 53 dB * fs / (22 * transition width) taps (Hamming window)
+                    auto samp_rate = variable.eval_param_value<double>("samp_rate", variables);
+                    auto width = variable.eval_param_value<double>("width", variables);
+                    return static_cast<size_t>(53.0 * samp_rate / (22.0 * width));
+                }
+            }
+        }
+    }
+    catch (...) {
+        // malformed parameters are reported once the block is made
+    }
+
+    return 0;
+}
+
+/*!
+ * Memory of the filter taps and history kept by a block.
+ */
+static size_t estimate_history_bytes(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    auto ntaps = estimate_ntaps(info, variables);
+    if (!ntaps) {
+        return 0;
+    }
+
+    size_t tap_size = sizeof(float), input_size = sizeof(float);
+    try {
+        if (info.key == freq_xlating_fir_filter_xxx_key) {
+            auto type = info.param_value("type");
+            tap_size = type.at(2) == 'c' ? sizeof(gr_complex) : sizeof(float);
+            input_size = type.at(0) == 'c' ? sizeof(gr_complex) : type.at(0) == 's' ? sizeof(short) : sizeof(float);
+        }
+    }
+    catch (...) {
+        // malformed parameters are reported once the block is made
+    }
+
+    // taps plus the matching history of input samples
+    return ntaps * (tap_size + input_size);
+}
+
+/*!
+ * Items a block needs in its input buffer, approximated from its taps and
+ * decimation. GraphBuilder::needed_buffer_items asks the made blocks instead.
+ */
+static long estimate_reader_items(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    long history = std::max(1L, static_cast<long>(estimate_ntaps(info, variables)));
+    long decimation = 1;
+    try {
+        for (const auto &param : {"decim", "decimation"}) {
+            if (info.is_param_set(param)) {
+                decimation = std::max(1L, static_cast<long>(info.eval_param_value<int>(param, variables)));
+            }
+        }
+    }
+    catch (...) {
+        // malformed parameters are reported once the block is made
+    }
+
+    return reader_buffer_items(history, decimation);
+}
+
+MemoryEstimate estimate_memory(const GraphInfo &graph, const BuildOptions &options)
+{
+    MemoryEstimate estimate;
+
+    const auto &variables = graph.variables;
+    auto rates = propagate_sample_rates(graph.blocks, graph.connections, variables);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for (const auto &info : graph.blocks) {
+        BlockMemory memory;
+        memory.block_id = info.id;
+        memory.type = info.key;
+        memory.output_buffers = 0;
+        memory.sink_buffers = estimate_sink_bytes(info, variables);
+        memory.history = estimate_history_bytes(info, variables);
+
+        long minoutbuf = 0, maxoutbuf = 0;
+        try {
+            if (info.is_param_set("minoutbuf")) {
+                minoutbuf = info.eval_param_value<int>("minoutbuf", variables);
+            }
+            if (info.is_param_set("maxoutbuf")) {
+                maxoutbuf = info.eval_param_value<int>("maxoutbuf", variables);
+            }
+        }
+        catch (...) {
+            // malformed parameters are reported once the block is made
+        }
+
+        auto item_size = estimate_item_size(info, variables);
+        auto rate_it = rates.find(info.id);
+
+        std::set<int> ports;
+        for (const auto &con : graph.connections) {
+            if (con.src_id == info.id) {
+                ports.insert(con.src_key);
+            }
+        }
+
+        for (int port : ports) {
+            long needed = 2;
+            for (const auto &con : graph.connections) {
+                if (con.src_id != info.id || con.src_key != port) {
+                    continue;
+                }
+                for (const auto &reader : graph.blocks) {
+                    if (reader.id == con.dst_id) {
+                        needed = std::max(needed, estimate_reader_items(reader, variables));
+                    }
+                }
+            }
+
+            // the setting GraphBuilder::plan_output_buffers applies, unless one is given
+            OutputBufferSetting setting = {minoutbuf, maxoutbuf};
+            if (minoutbuf <= 0 && maxoutbuf <= 0 && options.auto_buffer_sizing && rate_it != rates.end()) {
+                setting = output_buffer_setting(
+                        planned_buffer_items(rate_it->second, options.target_latency, needed, item_size, page_size),
+                        item_size);
+            }
+
+            long nitems = allocated_buffer_items(needed, item_size, setting.minoutbuf, setting.maxoutbuf, page_size);
+            size_t buffer_bytes = nitems * item_size;
+            memory.output_buffers += buffer_bytes;
+
+            for (const auto &con : graph.connections) {
+                if (con.src_id == info.id && con.src_key == port) {
+                    EdgeMemory edge = {con.src_id, con.src_key, con.dst_id, con.dst_key, item_size, buffer_bytes};
+                    estimate.edges.push_back(edge);
+                }
+            }
+        }
+
+        estimate.total += memory.total();
+        estimate.blocks.push_back(memory);
+    }
+
+    return estimate;
+}
+
+/*!
+ * Describes why a memory estimate exceeds the budget, empty if it does not.
+ */
+static std::string memory_budget_violation(const MemoryEstimate &memory, size_t budget)
+{
+    if (!budget || memory.total <= budget) {
+        return "";
+    }
+
+    auto blocks = memory.blocks;
+    std::sort(blocks.begin(), blocks.end(),
+            [](const BlockMemory &a, const BlockMemory &b) { return a.total() > b.total(); });
+
+    std::ostringstream message;
+    message << "estimated memory of " << memory.total << " bytes exceeds the budget of " << budget << " bytes. Largest blocks:";
+    for (size_t i = 0; i < blocks.size() && i < 5; i++) {
+        message << " " << blocks[i].block_id << " (" << blocks[i].total() << " bytes)";
+    }
+    return message.str();
+}
+
+/*!
+ * Checks a single parameter the way the block maker reads it. Returns an error
+ * message, empty if the parameter is fine.
+ */
+static std::string check_param(const BlockInfo &info, const ParamSpec &spec, const std::vector<BlockInfo> &variables)
+{
+    std::ostringstream message;
+    message << "parameter '" << spec.name << "'";
+
+    if (!info.params.count(spec.name)) {
+        message << " is missing";
+        return message.str();
+    }
+
+    try {
+        switch (spec.kind) {
+        case ParamKind::TEXT:
+        {
+            auto value = info.param_value(spec.name);
+            if (!spec.choices.empty() && std::find(spec.choices.begin(), spec.choices.end(), value) == spec.choices.end()) {
+                message << " has unsupported value '" << value << "', expected one of:";
+                for (const auto &choice : spec.choices) {
+                    message << " '" << choice << "'";
+                }
+                return message.str();
+            }
+            break;
+        }
+        case ParamKind::BOOL:
+            info.param_value<bool>(spec.name);
+            break;
+        case ParamKind::INTEGER:
+            info.param_value<int>(spec.name);
+            break;
+        case ParamKind::REAL:
+            info.param_value<double>(spec.name);
+            break;
+        case ParamKind::EXPRESSION:
+        case ParamKind::VECTOR:
+        {
+            std::vector<std::string> expressions;
+            if (spec.kind == ParamKind::EXPRESSION) {
+                expressions.push_back(info.param_value(spec.name));
+            }
+            else {
+                // empty vectors, e.g. "()", and trailing commas are accepted
+                for (const auto &element : info.param_vector_elements(spec.name)) {
+                    if (!element.empty() && element != "()" && element != "[]") {
+                        expressions.push_back(element);
+                    }
+                }
+            }
+
+            auto variable_map = BlockInfo::variable_values(variables);
+            for (const auto &expression : expressions) {
+                std::string error;
+                if (!detail::is_valid_expression(expression, variable_map, error)) {
+                    message << " can't be evaluated, expression: " << expression << ". Error: " << error;
+                    return message.str();
+                }
+            }
+            break;
+        }
+        case ParamKind::CPU_LIST:
+            parse_cpu_list(info.param_value(spec.name));
+            break;
+        case ParamKind::PRIORITY:
+            parse_thread_priority(info.param_value(spec.name));
+            break;
+        case ParamKind::WINDOW:
+        {
+            auto value = info.param_value(spec.name);
+            auto windows = BlockInfo::window_types();
+            if (value.find("firdes.") != 0 || !windows.count(value.substr(7))) {
+                message << " is not a firdes window type: " << value;
+                return message.str();
+            }
+            break;
+        }
+        case ParamKind::VARIABLE:
+        {
+            auto name = info.param_value(spec.name);
+            if (std::none_of(variables.begin(), variables.end(),
+                    [&name](const BlockInfo &variable) { return variable.id == name; })) {
+                message << " refers to unknown variable '" << name << "'";
+                return message.str();
+            }
+            break;
+        }
+        }
+    }
+    catch (const std::exception &e) {
+        message << " is invalid: " << e.what();
+        return message.str();
+    }
+
+    return "";
+}
+
+std::vector<ValidationError> validate_graph(const GraphInfo &graph, const BuildOptions &options)
+{
+    std::vector<ValidationError> errors;
+    BlockFactory factory;
+
+    // a variable which is not a number breaks the evaluation of all expressions
+    std::vector<BlockInfo> variables;
+    for (const auto &variable : graph.variables) {
+        try {
+            if (variable.is_param_set("value")) {
+                variable.param_value<double>("value");
+            }
+            variables.push_back(variable);
+        }
+        catch (const std::exception &e) {
+            ValidationError error = {variable.id, "variable value is not a number: " + variable.param_value("value")};
+            errors.push_back(error);
+        }
+    }
+
+    for (const auto &spec : options_parameters(graph.top_block)) {
+        auto message = check_param(graph.top_block, spec, variables);
+        if (!message.empty()) {
+            ValidationError error = {graph.top_block.id, message};
+            errors.push_back(error);
+        }
+    }
+
+    GraphInfo enabled;
+    enabled.top_block = graph.top_block;
+    enabled.variables = variables;
+
+    std::set<std::string> ids, disabled_blocks;
+    std::map<std::string, IoSizes> io;
+    for (const auto &info : graph.blocks) {
+        try {
+            if (!info.param_value<bool>("_enabled")) {
+                disabled_blocks.insert(info.id);
+                continue;
+            }
+        }
+        catch (const std::exception &e) {
+            ValidationError error = {info.id, "parameter '_enabled' is invalid: " + std::string(e.what())};
+            errors.push_back(error);
+            disabled_blocks.insert(info.id);
+            continue;
+        }
+
+        if (!ids.insert(info.id).second) {
+            ValidationError error = {info.id, "block id is used more than once"};
+            errors.push_back(error);
+            continue;
+        }
+
+        auto maker = factory.maker(info.key);
+        if (!maker) {
+            ValidationError error = {info.id, "block type " + info.key + " not supported"};
+            errors.push_back(error);
+            continue;
+        }
+        enabled.blocks.push_back(info);
+
+        auto params = maker->parameters(info);
+        auto common = BlockFactory::common_parameters(info);
+        params.insert(params.end(), common.begin(), common.end());
+
+        bool params_valid = true;
+        for (const auto &spec : params) {
+            auto message = check_param(info, spec, variables);
+            if (!message.empty()) {
+                ValidationError error = {info.id, message};
+                errors.push_back(error);
+                params_valid = false;
+            }
+        }
+
+        IoSizes sizes;
+        try {
+            if (params_valid && maker->io_sizes(info, variables, sizes)) {
+                io[info.id] = sizes;
+            }
+        }
+        catch (const std::exception &e) {
+            ValidationError error = {info.id, "can't determine port sizes: " + std::string(e.what())};
+            errors.push_back(error);
+        }
+    }
+
+    std::set<std::pair<std::string, int>> connected_inputs;
+    for (const auto &con : graph.connections) {
+        if (disabled_blocks.count(con.src_id) || disabled_blocks.count(con.dst_id)) {
+            continue;
+        }
+
+        std::ostringstream connection;
+        connection << "connection " << con << ": ";
+
+        bool known = true;
+        for (const auto &id : {con.src_id, con.dst_id}) {
+            if (!ids.count(id)) {
+                ValidationError error = {id, connection.str() + "unknown block " + id};
+                errors.push_back(error);
+                known = false;
+            }
+        }
+        if (!known) {
+            continue;
+        }
+        enabled.connections.push_back(con);
+
+        if (!connected_inputs.insert(std::make_pair(con.dst_id, con.dst_key)).second) {
+            ValidationError error = {con.dst_id, connection.str() + "input port is already connected"};
+            errors.push_back(error);
+        }
+
+        // item size of a port, 0 if unknown or the port doesn't exist
+        auto port_size = [&](const std::string &id, int port, bool output, std::string &problem) -> size_t {
+            auto it = io.find(id);
+            if (it == io.end()) {
+                return 0;
+            }
+            const auto &ports = output ? it->second.outputs : it->second.inputs;
+            bool open = output ? it->second.open_outputs : it->second.open_inputs;
+            if (port >= 0 && static_cast<size_t>(port) < ports.size()) {
+                return ports[port];
+            }
+            if (port >= 0 && open && !ports.empty()) {
+                return ports.back();
+            }
+            std::ostringstream message;
+            message << (output ? "output" : "input") << " port " << port << " of " << id << " doesn't exist, the block has "
+                    << ports.size() << (output ? " output(s)" : " input(s)");
+            problem = message.str();
+            return 0;
+        };
+
+        std::string src_problem, dst_problem;
+        auto src_size = port_size(con.src_id, con.src_key, true, src_problem);
+        auto dst_size = port_size(con.dst_id, con.dst_key, false, dst_problem);
+        if (!src_problem.empty()) {
+            ValidationError error = {con.src_id, connection.str() + src_problem};
+            errors.push_back(error);
+        }
+        if (!dst_problem.empty()) {
+            ValidationError error = {con.dst_id, connection.str() + dst_problem};
+            errors.push_back(error);
+        }
+        if (src_size && dst_size && src_size != dst_size) {
+            std::ostringstream message;
+            message << connection.str() << "item size mismatch, " << src_size << " bytes at the output and "
+                    << dst_size << " bytes at the input";
+            ValidationError error = {con.dst_id, message.str()};
+            errors.push_back(error);
+        }
+    }
+
+    auto budget = memory_budget_violation(estimate_memory(enabled, options), options.memory_budget);
+    if (!budget.empty()) {
+        ValidationError error = {"", budget};
+        errors.push_back(error);
+    }
+
+    return errors;
+}
+
+std::vector<ParamSpec> options_parameters(const BlockInfo &top_block)
+{
+    std::vector<ParamSpec> params;
+    if (top_block.is_param_set("max_nouts")) {
+        params.push_back(ParamSpec("max_nouts", ParamKind::INTEGER));
+    }
+    if (top_block.is_param_set("realtime_scheduling")) {
+        params.push_back(ParamSpec("realtime_scheduling", ParamKind::BOOL));
+    }
+    if (top_block.is_param_set("scheduler")) {
+        params.push_back(ParamSpec("scheduler", ParamKind::TEXT, {"TPB", "STS"}));
+    }
+    return params;
+}
+
+std::vector<ParamSpec> variable_parameters(const BlockInfo &info)
+{
+    if (info.key == band_pass_filter_taps_key) {
+        return { {"type", ParamKind::TEXT, {"taps_real", "taps_complex"}},
+                {"gain", ParamKind::EXPRESSION},
+                {"samp_rate", ParamKind::EXPRESSION},
+                {"low_cutoff_freq", ParamKind::EXPRESSION},
+                {"high_cutoff_freq", ParamKind::EXPRESSION},
+                {"width", ParamKind::EXPRESSION},
+                {"win", ParamKind::WINDOW},
+                {"beta", ParamKind::EXPRESSION} };
+    }
+    return std::vector<ParamSpec>();
+}
+
+/*!
+ * Shortest representation of a value which reads back to the same double.
+ */
+static std::string format_value(double value)
+{
+    for (int precision : {15, 17}) {
+        std::ostringstream ss;
+        ss.precision(precision);
+        ss << value;
+        if (precision == 17 || std::strtod(ss.str().c_str(), nullptr) == value) {
+            return ss.str();
+        }
+    }
+    return "";
+}
+
+/*!
+ * Replaces the expressions of a block, as described by specs, by their values.
+ */
+static void fold_block(BlockInfo &info, const std::vector<ParamSpec> &specs, const std::vector<BlockInfo> &variables)
+{
+    auto variable_map = BlockInfo::variable_values(variables);
+
+    for (const auto &spec : specs) {
+        if (!info.params.count(spec.name)
+                || (spec.kind != ParamKind::EXPRESSION && spec.kind != ParamKind::VECTOR)) {
+            continue;
+        }
+
+        auto elements = spec.kind == ParamKind::EXPRESSION
+                ? std::vector<std::string>{info.param_value(spec.name)}
+                : info.param_vector_elements(spec.name);
+
+        std::vector<std::string> values;
+        for (const auto &element : elements) {
+            std::string error;
+            if (element.empty() || element == "()" || element == "[]"
+                    || !detail::is_valid_expression(element, variable_map, error)) {
+                break;
+            }
+            auto value = detail::evaluate_expression(element, variable_map);
+            if (!std::isfinite(value)) {
+                break;
+            }
+            values.push_back(format_value(value));
+        }
+        if (values.size() != elements.size()) {
+            continue; // keep the expression
+        }
+
+        if (spec.kind == ParamKind::EXPRESSION) {
+            info.params[spec.name] = values[0];
+        }
+        else {
+            info.params[spec.name] = "(" + boost::algorithm::join(values, ",") + ")";
+        }
+    }
+}
+
+GraphInfo fold_constants(const GraphInfo &graph)
+{
+    auto folded = enabled_graph(graph);
+    BlockFactory factory;
+
+    // variables first, their values are needed unchanged for the blocks
+    std::vector<BlockInfo> variables = folded.variables;
+    for (auto &variable : folded.variables) {
+        fold_block(variable, variable_parameters(variable), variables);
+    }
+
+    for (auto &info : folded.blocks) {
+        auto maker = factory.maker(info.key);
+        if (!maker) {
+            continue;
+        }
+        auto specs = maker->parameters(info);
+        auto common = BlockFactory::common_parameters(info);
+        specs.insert(specs.end(), common.begin(), common.end());
+        fold_block(info, specs, variables);
+    }
+
+    return folded;
+}
+
+static BlockInfo block_info(const StaticBlock &block)
+{
+    BlockInfo info;
+    info.key = block.key;
+    info.id = block.id;
+    for (size_t i = 0; i < block.param_count; i++) {
+        info.params[block.params[i].name] = block.params[i].value;
+    }
+    return info;
+}
+
+GraphInfo graph_info(const StaticGraph &graph)
+{
+    GraphInfo info;
+    info.top_block = block_info(graph.top_block);
+    for (size_t i = 0; i < graph.variable_count; i++) {
+        info.variables.push_back(block_info(graph.variables[i]));
+    }
+    for (size_t i = 0; i < graph.block_count; i++) {
+        info.blocks.push_back(block_info(graph.blocks[i]));
+    }
+    for (size_t i = 0; i < graph.connection_count; i++) {
+        const auto &con = graph.connections[i];
+        ConnectionInfo connection = {con.src_id, con.dst_id, con.src_port, con.dst_port};
+        info.connections.push_back(connection);
+    }
+    return info;
+}
+
+static bool editor_param(const std::string &name)
+{
+    return name.empty() || name[0] == '_' || name == "comment" || name == "alias";
+}
+
+std::string block_signature(const BlockInfo &info, const std::vector<BlockInfo> &variables)
+{
+    std::ostringstream ss;
+    ss << info.key;
+    for (const auto &param : info.params) {
+        if (editor_param(param.first)) {
+            continue;
+        }
+        ss << "\n" << param.first << "=" << param.second;
+
+        // variables referenced by name, e.g. filter taps
+        for (const auto &variable : variables) {
+            if (variable.id != param.second) {
+                continue;
+            }
+            ss << " {" << variable.key;
+            for (const auto &var_param : variable.params) {
+                if (!editor_param(var_param.first)) {
+                    ss << " " << var_param.first << "=" << var_param.second;
+                }
+            }
+            ss << "}";
+        }
+    }
+    return ss.str();
+}
+
+void GraphBuilder::apply_options(FlowGraph &graph, const BlockInfo &top_block)
+{
+    auto &report = graph.d_build_report;
+
+    // 0 stands for the GNU Radio default in GRC
+    if (top_block.is_param_set("max_nouts") && top_block.param_value<int>("max_nouts") > 0) {
+        report.max_noutput_items = top_block.param_value<int>("max_nouts");
+    }
+
+    // applied by FlowGraph::start, on the thread starting the scheduler threads
+    report.realtime_requested = top_block.is_param_set("realtime_scheduling")
+            && top_block.param_value<bool>("realtime_scheduling");
+
+    report.scheduler_requested = !d_options.scheduler.empty() ? d_options.scheduler
+            : top_block.is_param_set("scheduler") ? top_block.param_value("scheduler") : std::string();
+    if (!report.scheduler_requested.empty() && report.scheduler_requested != "TPB" && report.scheduler_requested != "STS") {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__
+                << ": unknown scheduler, expected TPB or STS: " << report.scheduler_requested;
+        throw std::invalid_argument(message.str());
+    }
+}
+
+void GraphBuilder::apply_pinning(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables)
+{
+    for (const auto &info : blocks) {
+        if (info.is_param_set("affinity")) {
+            auto affinity = parse_cpu_list(info.param_value("affinity"));
+            if (!affinity.empty()) {
+                graph.d_build_report.affinity[info.id] = affinity;
+            }
+        }
+    }
+
+    if (d_options.pinning == PinningPolicy::NONE && !d_options.numa_placement) {
+        return;
+    }
+
+    auto cpus = d_options.pinning_cpus.empty() ? pinning_cpus() : d_options.pinning_cpus;
+
+    std::set<std::string> hierarchical;
+    for (const auto &info : blocks) {
+        if (boost::dynamic_pointer_cast<gr::hier_block2>(graph.d_block_map.at(info.id).block)) {
+            hierarchical.insert(info.id);
+        }
+    }
+
+    // each group of blocks pinned within one set of CPUs
+    std::vector<std::pair<std::vector<BlockInfo>, std::vector<int>>> groups;
+
+    if (d_options.numa_placement) {
+        // bytes per second produced by each block
+        auto rates = propagate_sample_rates(blocks, connections, variables);
+        std::map<std::string, double> load;
+        for (const auto &edge : graph.d_build_report.memory.edges) {
+            auto rate = rates.find(edge.src_id);
+            if (rate != rates.end()) {
+                load[edge.src_id] += rate->second * edge.item_size;
+            }
+        }
+
+        auto nodes = numa_nodes();
+        auto placement = plan_numa_nodes(blocks, connections, load, nodes);
+        graph.d_build_report.numa_node = placement;
+
+        // on a single node the placement is only reported
+        if (nodes.size() > 1) {
+            for (const auto &node : nodes) {
+                std::vector<BlockInfo> node_blocks;
+                for (const auto &info : blocks) {
+                    if (placement.at(info.id) == node.node) {
+                        node_blocks.push_back(info);
+                    }
+                }
+
+                std::vector<int> node_cpus;
+                for (int cpu : cpus) {
+                    if (std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end()) {
+                        node_cpus.push_back(cpu);
+                    }
+                }
+                groups.push_back(std::make_pair(node_blocks, node_cpus.empty() ? node.cpus : node_cpus));
+            }
+        }
+    }
+
+    if (groups.empty()) {
+        groups.push_back(std::make_pair(blocks, cpus));
+    }
+
+    for (const auto &group : groups) {
+        std::map<std::string, std::vector<int>> plan;
+        if (d_options.pinning == PinningPolicy::NONE) {
+            // NUMA placement alone, confine the blocks to their node
+            for (const auto &info : group.first) {
+                if (!graph.d_build_report.affinity.count(info.id)) {
+                    plan[info.id] = group.second;
+                }
+            }
+        }
+        else {
+            std::vector<std::vector<int>> domains;
+            if (d_options.pinning == PinningPolicy::SHARED_CACHE) {
+                domains = cache_domains(group.second);
+            }
+            plan = plan_affinity(group.first, connections, hierarchical, d_options.pinning, group.second, domains);
+        }
+
+        for (const auto &entry : plan) {
+            graph.d_block_map.at(entry.first).block->set_processor_affinity(entry.second);
+            graph.d_build_report.affinity[entry.first] = entry.second;
+        }
+    }
+}
+
+void GraphBuilder::apply_latency_classes(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables)
+{
+    auto classes = assign_latency_classes(blocks, connections);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for (const auto &info : blocks) {
+        const auto &latency_class = classes.at(info.id);
+        bool low_latency = latency_class.first == "low";
+
+        LatencyPlan plan;
+        plan.block_id = info.id;
+        plan.latency_class = latency_class.first;
+        plan.inherited = latency_class.second;
+        plan.max_noutput_items = 0;
+        plan.buffer_items = 0;
+
+        // hierarchical blocks have no chunk size of their own
+        auto block = graph.d_block_map.at(info.id).block;
+        gr::block_sptr blk_ptr = boost::dynamic_pointer_cast<gr::block>(block);
+        if (!blk_ptr) {
+            graph.d_build_report.latency.push_back(plan);
+            continue;
+        }
+
+        // explicit parameters win over the class
+        bool explicit_chunk = info.is_param_set("max_noutput_items")
+                && info.eval_param_value<int>("max_noutput_items", variables) > 0;
+        bool explicit_buffer =
+                (info.is_param_set("minoutbuf") && info.eval_param_value<int>("minoutbuf", variables) > 0)
+             || (info.is_param_set("maxoutbuf") && info.eval_param_value<int>("maxoutbuf", variables) > 0);
+
+        int chunk = low_latency ? d_options.low_latency_noutput_items : d_options.throughput_noutput_items;
+        if (!explicit_chunk && chunk > 0) {
+            blk_ptr->set_max_noutput_items(chunk);
+            plan.max_noutput_items = chunk;
+        }
+
+        if (low_latency && !explicit_buffer && chunk > 0) {
+            std::set<int> ports;
+            for (const auto &con : connections) {
+                if (con.src_id == info.id) {
+                    ports.insert(con.src_key);
+                }
+            }
+
+            for (int port : ports) {
+                // two chunks, but GNU Radio's maxoutbuf caps even below what the readers need
+                size_t item_size = block->output_signature()->sizeof_stream_item(port);
+                long needed = needed_buffer_items(graph, connections, info.id, port);
+                long nitems = round_to_pages(std::max(2L * chunk, needed), item_size, page_size);
+
+                // keep a smaller size chosen by automatic buffer sizing
+                for (auto &buffer : graph.d_build_report.buffers) {
+                    if (buffer.block_id == info.id && buffer.port == port && buffer.nitems > 0) {
+                        nitems = std::min(nitems, buffer.nitems);
+                        buffer.nitems = nitems;
+                    }
+                }
+
+                blk_ptr->set_max_output_buffer(port, nitems);
+                plan.buffer_items = std::max(plan.buffer_items, nitems);
+            }
+        }
+
+        graph.d_build_report.latency.push_back(plan);
+    }
+}
+
+long GraphBuilder::needed_buffer_items(const FlowGraph &graph, const std::vector<ConnectionInfo> &connections,
+        const std::string &block_id, int port)
+{
+    auto writer = boost::dynamic_pointer_cast<gr::block>(graph.d_block_map.at(block_id).block);
+    long needed = writer ? 2 * writer->output_multiple() : 1;
+
+    for (const auto &con : connections) {
+        if (con.src_id != block_id || con.src_key != port) {
+            continue;
+        }
+        auto reader = boost::dynamic_pointer_cast<gr::block>(graph.d_block_map.at(con.dst_id).block);
+        if (reader && reader->relative_rate() > 0.0) {
+            long per_call = static_cast<long>(std::ceil(reader->output_multiple() / reader->relative_rate()));
+            needed = std::max(needed, reader_buffer_items(static_cast<long>(reader->history()), per_call));
+        }
+    }
+
+    return needed;
+}
+
+void GraphBuilder::plan_output_buffers(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables)
+{
+    auto rates = propagate_sample_rates(blocks, connections, variables);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for (const auto &info : blocks) {
+        // GNU Radio allocates buffers for connected output ports only
+        std::set<int> ports;
+        for (const auto &con : connections) {
+            if (con.src_id == info.id) {
+                ports.insert(con.src_key);
+            }
+        }
+        if (ports.empty()) {
+            continue;
+        }
+
+        bool explicit_setting =
+                (info.is_param_set("minoutbuf") && info.eval_param_value<int>("minoutbuf", variables) > 0)
+             || (info.is_param_set("maxoutbuf") && info.eval_param_value<int>("maxoutbuf", variables) > 0);
+
+        auto rate_it = rates.find(info.id);
+        double rate = rate_it != rates.end() ? rate_it->second : 0.0;
+
+        auto block = graph.d_block_map.at(info.id).block;
+        gr::block_sptr blk_ptr = boost::dynamic_pointer_cast<gr::block>(block);
+        gr::hier_block2_sptr hb2_ptr = boost::dynamic_pointer_cast<gr::hier_block2>(block);
+
+        for (int port : ports) {
+            OutputBufferPlan plan;
+            plan.block_id = info.id;
+            plan.port = port;
+            plan.item_size = block->output_signature()->sizeof_stream_item(port); // includes the vector length
+            plan.samp_rate = rate;
+            plan.nitems = 0;
+            plan.explicit_setting = explicit_setting;
+
+            if (!explicit_setting && rate > 0.0) {
+                long needed = needed_buffer_items(graph, connections, info.id, port);
+                plan.nitems = planned_buffer_items(rate, d_options.target_latency, needed, plan.item_size, page_size);
+                auto setting = output_buffer_setting(plan.nitems, plan.item_size);
+
+                if (blk_ptr) {
+                    if (setting.minoutbuf) {
+                        blk_ptr->set_min_output_buffer(port, setting.minoutbuf);
+                    }
+                    if (setting.maxoutbuf) {
+                        blk_ptr->set_max_output_buffer(port, setting.maxoutbuf);
+                    }
+                }
+                else if (hb2_ptr) {
+                    if (setting.minoutbuf) {
+                        hb2_ptr->set_min_output_buffer(static_cast<size_t>(port), static_cast<int>(setting.minoutbuf));
+                    }
+                    if (setting.maxoutbuf) {
+                        hb2_ptr->set_max_output_buffer(static_cast<size_t>(port), static_cast<int>(setting.maxoutbuf));
+                    }
+                }
+                else {
+                    std::cerr << "cannot size output buffer of block " << info.id << "!\n";
+                    plan.nitems = 0;
+                }
+            }
+
+            graph.d_build_report.buffers.push_back(plan);
+        }
+    }
+}
+
+/*!
+ * Streaming parameters left to the planner: "auto", empty or 0.
+ */
+static bool needs_plan(const BlockInfo &info, const std::string &param, const std::vector<BlockInfo> &variables)
+{
+    if (!info.is_param_set(param)) {
+        return true;
+    }
+    auto value = boost::algorithm::trim_copy(info.param_value(param));
+    return value == "auto" || info.eval_param_value<double>(param, variables) == 0.0;
+}
+
+GraphInfo plan_digitizer_streaming(const GraphInfo &graph, double target_latency,
+        std::vector<DigitizerPlan> *plans)
+{
+    auto result = graph;
+    const auto &variables = result.variables;
+
+    for (auto &info : result.blocks) {
+        if ((info.key != picoscope_3000a_key && info.key != picoscope_4000a_key && info.key != picoscope_6000_key)
+                || !info.params.count("acquisition_mode") || info.param_value("acquisition_mode") != "Streaming") {
+            continue;
+        }
+
+        DigitizerPlan plan;
+        try {
+            plan.block_id = info.id;
+            plan.buff_size_planned = needs_plan(info, "buff_size", variables);
+            plan.poll_rate_planned = needs_plan(info, "poll_rate", variables);
+            if (!plan.buff_size_planned && !plan.poll_rate_planned) {
+                continue;
+            }
+
+            plan.channels = 0;
+            for (const auto &param : info.params) {
+                if (param.first.find("enable_ai_") == 0 && info.param_value<bool>(param.first)) {
+                    plan.channels++;
+                }
+            }
+
+            // downsampling mode 0 is none
+            auto samp_rate = info.eval_param_value<double>("samp_rate", variables);
+            auto factor = info.param_value<int>("downsampling_mode") != 0
+                    ? std::max(1, info.eval_param_value<int>("downsampling_factor", variables)) : 1;
+            plan.output_rate = samp_rate / factor;
+
+            plan.poll_rate = plan.poll_rate_planned
+                    ? std::min(0.1, std::max(0.001, target_latency / 2))
+                    : info.eval_param_value<double>("poll_rate", variables);
+
+            plan.buff_size = info.is_param_set("buff_size") && !plan.buff_size_planned
+                    ? info.eval_param_value<int>("buff_size", variables) : 8192;
+            if (plan.buff_size_planned) {
+                double samples = 4 * plan.output_rate * plan.poll_rate;
+                while (plan.buff_size < samples && plan.buff_size < (1 << 30)) {
+                    plan.buff_size *= 2;
+                }
+            }
+
+            plan.minoutbuf_planned = needs_plan(info, "minoutbuf", variables);
+            plan.minoutbuf = plan.minoutbuf_planned ? 2L * plan.buff_size
+                    : info.eval_param_value<int>("minoutbuf", variables);
+        }
+        catch (const std::exception &) {
+            // reported by validation or once the block is made
+            continue;
+        }
+
+        std::ostringstream poll_rate;
+        poll_rate << plan.poll_rate;
+        info.params["buff_size"] = std::to_string(plan.buff_size);
+        info.params["poll_rate"] = poll_rate.str();
+        if (plan.minoutbuf_planned) {
+            info.params["minoutbuf"] = std::to_string(plan.minoutbuf);
+        }
+
+        if (plans) {
+            plans->push_back(plan);
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * Overlay values are plain strings, JSON arrays are turned into GRC lists.
+ */
+static std::string overlay_value(const boost::property_tree::ptree &value)
+{
+    if (value.empty()) {
+        return value.data();
+    }
+
+    std::string list = "[";
+    for (const auto &element : value) {
+        list += (list.size() > 1 ? "," : "") + element.second.data();
+    }
+    return list + "]";
+}
+
+GraphInfo apply_overlay(const GraphInfo &graph, std::istream &overlay, bool json)
+{
+    boost::property_tree::ptree tree;
+    if (json) {
+        boost::property_tree::read_json(overlay, tree);
+    }
+    else {
+        boost::property_tree::read_ini(overlay, tree);
+    }
+
+    static const std::set<std::string> block_params = {
+        "affinity", "minoutbuf", "maxoutbuf", "max_noutput_items", "priority", "latency_class",
+        "shed_order"
+    };
+    static const std::set<std::string> options_params = {
+        "max_nouts", "realtime_scheduling", "scheduler"
+    };
+
+    auto result = graph;
+    auto invalid = [](const std::string &what) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": overlay: " << what;
+        throw std::invalid_argument(message.str());
+    };
+
+    // key selectors first, ids last, the most specific selector wins
+    const char *kinds[] = {"key", "glob", "id"};
+    for (const char *kind : kinds) {
+        for (const auto &section : tree) {
+            if (section.first == "options") {
+                if (std::string(kind) == "id") {
+                    for (const auto &param : section.second) {
+                        if (!options_params.count(param.first)) {
+                            invalid("unsupported option " + param.first);
+                        }
+                        result.top_block.params[param.first] = overlay_value(param.second);
+                    }
+                }
+                continue;
+            }
+
+            auto colon = section.first.find(':');
+            auto selector = colon == std::string::npos ? std::string("id") : section.first.substr(0, colon);
+            auto pattern = colon == std::string::npos ? section.first : section.first.substr(colon + 1);
+            if (selector != "id" && selector != "key" && selector != "glob") {
+                invalid("unknown selector " + section.first + ", expected id:, key: or glob:");
+            }
+            if (selector != kind) {
+                continue;
+            }
+
+            bool matched = false;
+            for (auto &info : result.blocks) {
+                bool match = selector == "id" ? info.id == pattern
+                           : selector == "key" ? info.key == pattern
+                           : fnmatch(pattern.c_str(), info.id.c_str(), 0) == 0;
+                if (!match) {
+                    continue;
+                }
+
+                matched = true;
+                for (const auto &param : section.second) {
+                    if (!block_params.count(param.first)) {
+                        invalid("unsupported parameter " + param.first + " in section " + section.first);
+                    }
+                    info.params[param.first] = overlay_value(param.second);
+                }
+            }
+
+            if (!matched) {
+                std::cerr << "overlay section " << section.first << " matches no block, skipping...\n";
+            }
+        }
+    }
+
+    return result;
+}
+
+GraphInfo apply_overlay_file(const GraphInfo &graph, const std::string &path)
+{
+    std::ifstream overlay(path);
+    if (!overlay) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": can't open overlay file " << path;
+        throw std::runtime_error(message.str());
+    }
+
+    bool json = boost::algorithm::iends_with(path, ".json");
+    return apply_overlay(graph, overlay, json);
+}
 
-		auto block = factory.make_block(info, variables);
-		graph->add(block, info.id, info.key);
+std::unique_ptr<FlowGraph> GraphBuilder::build(const GraphInfo &input, FlowGraph *previous)
+{
+	// host specific tuning, applied before any block is made
+	auto graph_info = d_options.overlay_file.empty() ? input : apply_overlay_file(input, d_options.overlay_file);
+	std::vector<DigitizerPlan> digitizers;
+	graph_info = plan_digitizer_streaming(graph_info, d_options.target_latency, &digitizers);
+
+	// obtain title if provided
+	std::string title = graph_info.top_block.param_value("title");
+	if (!title.length())
+	{
+		title = "My Flowgraph";
 	}
 
- 	//graph->connect(info.src_id);
+	auto enabled = enabled_graph(graph_info);
+	const auto &variables = enabled.variables;
 
-	for (const auto info : parser.connections()) {
-	    // connect only if both ends are enabled
-	    if (std::count(disabled_blocks.begin(), disabled_blocks.end(), info.src_id)
-	     || std::count(disabled_blocks.begin(), disabled_blocks.end(), info.dst_id))
-	    {
-	        continue;
+	// check the memory budget before anything is allocated
+	auto memory = estimate_memory(enabled, d_options);
+	auto violation = memory_budget_violation(memory, d_options.memory_budget);
+	if (!violation.empty())
+	{
+	    std::ostringstream message;
+	    message << "Exception in " << __FILE__ << ":" << __LINE__ << ": " << violation;
+	    throw std::runtime_error(message.str());
+	}
+
+	// take over the unchanged stateful blocks, release all other blocks of the
+	// previous flowgraph before making new ones, e.g. to reopen digitizers
+	std::map<std::string, gr::basic_block_sptr> adopted;
+	std::map<std::string, FlowGraph::FlowGraphEntry> adopted_entries;
+	if (previous)
+	{
+	    previous->stop();
+	    previous->wait();
+
+	    for (const auto &info : enabled.blocks) {
+	        auto it = previous->d_block_map.find(info.id);
+	        auto maker = d_factory.maker(info.key);
+	        if (it != previous->d_block_map.end() && it->second.type == info.key
+	                && maker && maker->transfer_state()
+	                && it->second.signature == block_signature(info, variables)) {
+	            adopted[info.id] = it->second.block;
+	            adopted_entries[info.id] = it->second;
+	        }
 	    }
-	    else
-	    {
-	    graph->connect(info.src_id, info.src_key,
-	                   info.dst_id, info.dst_key);
+
+	    previous->d_top_block->disconnect_all();
+	    previous->d_block_map.clear();
+	    previous->d_topology = Topology();
+	    previous->d_top_block = gr::make_top_block(previous->d_top_block->name());
+	}
+
+	// make graph, add blocks and connections
+	std::unique_ptr<FlowGraph> graph(new FlowGraph(title));
+	graph->d_build_report.memory = memory;
+	graph->d_build_report.digitizers = digitizers;
+	graph->d_sequenced_start = d_options.sequenced_start;
+	graph->d_startup_monitor = d_options.startup_monitor;
+
+	try
+	{
+	    populate(*graph, graph_info, enabled, adopted);
+	}
+	catch (...)
+	{
+	    // hand the adopted blocks back, the previous flowgraph can be rebuilt with their state
+	    if (previous) {
+	        graph->d_top_block->disconnect_all();
+	        for (const auto &entry : adopted_entries) {
+	            previous->d_block_map[entry.first] = entry.second;
+	        }
 	    }
-    }
-	return std::move(graph);
+	    throw;
+	}
+	return graph;
+}
+
+/*!
+ * Settings of an adopted block made for the previous flowgraph, they are
+ * applied again for the new one.
+ */
+static void reset_block_settings(const gr::basic_block_sptr &block)
+{
+	block->unset_processor_affinity();
+
+	gr::block_sptr blk_ptr = boost::dynamic_pointer_cast<gr::block>(block);
+	gr::hier_block2_sptr hb2_ptr = boost::dynamic_pointer_cast<gr::hier_block2>(block);
+	if (blk_ptr) {
+	    blk_ptr->unset_max_noutput_items();
+	    blk_ptr->set_min_output_buffer(0L);
+	    blk_ptr->set_max_output_buffer(0L);
+	}
+	else if (hb2_ptr) {
+	    hb2_ptr->set_min_output_buffer(0);
+	    hb2_ptr->set_max_output_buffer(0);
+	}
+}
+
+void GraphBuilder::populate(FlowGraph &graph, const GraphInfo &graph_info, const GraphInfo &enabled,
+        const std::map<std::string, gr::basic_block_sptr> &adopted)
+{
+	const auto &variables = enabled.variables;
+	apply_options(graph, graph_info.top_block);
+
+ 	for (const auto &enabled_info : enabled.blocks)
+ 	{
+		// sequenced starts arm the digitizers themselves
+		auto info = enabled_info;
+		bool digitizer = std::find(digitizer_keys.begin(), digitizer_keys.end(), info.key) != digitizer_keys.end();
+		if (d_options.sequenced_start && digitizer) {
+		    info.params["auto_arm"] = "False";
+		}
+
+		gr::basic_block_sptr block;
+		auto previous_block = adopted.find(info.id);
+		if (previous_block != adopted.end()) {
+		    block = previous_block->second;
+		    reset_block_settings(block);
+		    d_factory.common_settings(block, info, variables);
+		    graph.d_build_report.adopted.push_back(info.id);
+		}
+		else {
+		    block = d_factory.make_block(info, variables);
+		}
+		graph.add(block, info.id, info.key);
+		graph.d_block_map[info.id].signature = block_signature(info, variables);
+
+		// block threads only exist once the flowgraph is started
+		if (info.is_param_set("priority")) {
+		    graph.d_priorities[info.id] = parse_thread_priority(info.param_value("priority"));
+		}
+
+		if (d_options.load_shedding.enabled && info.is_param_set("shed_order")) {
+		    auto order = info.eval_param_value<int>("shed_order", variables);
+		    if (order > 0) {
+		        graph.d_shed_orders[info.id] = order;
+		    }
+		}
+	}
+
+	if (d_options.auto_buffer_sizing) {
+	    plan_output_buffers(graph, enabled.blocks, enabled.connections, variables);
+	}
+	apply_latency_classes(graph, enabled.blocks, enabled.connections, variables);
+	apply_pinning(graph, enabled.blocks, enabled.connections, variables);
+
+	std::set<std::string> valved(d_options.branch_valves.begin(), d_options.branch_valves.end());
+	for (const auto &entry : graph.d_shed_orders) {
+	    valved.insert(entry.first);
+	}
+	graph.d_load_shedding = d_options.load_shedding;
+	for (const auto &id : valved) {
+	    if (!graph.d_block_map.count(id)) {
+	        std::ostringstream message;
+	        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": branch valve for unknown block " << id;
+	        throw std::invalid_argument(message.str());
+	    }
+	}
+
+	for (const auto &info : enabled.connections) {
+	    if (!valved.count(info.dst_id)) {
+	        graph.connect(info.src_id, info.src_key,
+	                       info.dst_id, info.dst_key);
+	        continue;
+	    }
+
+	    // src -> valve -> dst, the valve copies items of the size of the source port
+	    auto valve_id = info.dst_id + "_valve_" + std::to_string(info.dst_key);
+	    auto src_block = graph.d_block_map[info.src_id].block;
+	    auto item_size = src_block->output_signature()->sizeof_stream_item(info.src_key);
+	    graph.add(gr::blocks::copy::make(item_size), valve_id, blocks_copy_key);
+	    graph.d_valves[info.dst_id].push_back(valve_id);
+
+	    graph.connect(info.src_id, info.src_key, valve_id, 0);
+	    graph.connect(valve_id, 0, info.dst_id, info.dst_key);
+	}
+}
+
+std::unique_ptr<FlowGraph> make_flowgraph(std::istream &input)
+{
+    return make_flowgraph(input, BuildOptions());
+}
+
+std::unique_ptr<FlowGraph> make_flowgraph(std::istream &input, const BuildOptions &options)
+{
+	// parse input and replace variables
+	flowgraph::GrcParser parser(input);
+	parser.parse();
+	parser.collapse_variables();
+
+	GraphBuilder builder(options);
+	return builder.build(parser.graph());
+}
+
+std::unique_ptr<FlowGraph> make_flowgraph(std::istream &input, const BuildOptions &options, FlowGraph &previous)
+{
+	flowgraph::GrcParser parser(input);
+	parser.parse();
+	parser.collapse_variables();
+
+	GraphBuilder builder(options);
+	return builder.build(parser.graph(), &previous);
+}
+
+std::unique_ptr<FlowGraph> make_flowgraph(const StaticGraph &graph, const BuildOptions &options)
+{
+	GraphBuilder builder(options);
+	return builder.build(graph_info(graph));
+}
+
+MemoryEstimate estimate_flowgraph_memory(std::istream &input, const BuildOptions &options)
+{
+	flowgraph::GrcParser parser(input);
+	parser.parse();
+	parser.collapse_variables();
+
+	auto graph = parser.graph();
+	if (!options.overlay_file.empty()) {
+		graph = apply_overlay_file(graph, options.overlay_file);
+	}
+	graph = plan_digitizer_streaming(graph, options.target_latency, nullptr);
+	return estimate_memory(enabled_graph(graph), options);
+}
+
+std::vector<ValidationError> validate_flowgraph(std::istream &input, const BuildOptions &options)
+{
+	flowgraph::GrcParser parser(input);
+	try {
+		parser.parse();
+	}
+	catch (const std::exception &e) {
+		ValidationError error = {"", std::string("can't parse flowgraph: ") + e.what()};
+		return std::vector<ValidationError>{error};
+	}
+	parser.collapse_variables();
+
+	auto graph = parser.graph();
+	if (!options.overlay_file.empty()) {
+		try {
+			graph = apply_overlay_file(graph, options.overlay_file);
+		}
+		catch (const std::exception &e) {
+			ValidationError error = {"", std::string("can't apply overlay: ") + e.what()};
+			return std::vector<ValidationError>{error};
+		}
+	}
+	graph = plan_digitizer_streaming(graph, options.target_latency, nullptr);
+	return validate_graph(graph, options);
 }
 
 }
@@ -165,16 +165,25 @@ struct BlockInfo
 	    return !value.empty();
 	}
 
-	template< class T, typename boost::enable_if< boost::is_arithmetic< T >, int >::type = 0>
-    T eval_param_value(const std::string &param_name, const std::vector<BlockInfo> &variables) const
-    {
+	/*!
+	 * Values of all variables which have one, used to evaluate expressions.
+	 */
+	static std::map<std::string, double> variable_values(const std::vector<BlockInfo> &variables)
+	{
 	    std::map<std::string, double> variable_map;
 
 	    for (auto &var : variables)
 	    {
 	        if(var.is_param_set("value"))
-	            variable_map[var.id] = var.param_value<T>("value");
+	            variable_map[var.id] = var.param_value<double>("value");
 	    }
+	    return variable_map;
+	}
+
+	template< class T, typename boost::enable_if< boost::is_arithmetic< T >, int >::type = 0>
+    T eval_param_value(const std::string &param_name, const std::vector<BlockInfo> &variables) const
+    {
+	    auto variable_map = variable_values(variables);
 	    auto expression = param_value(param_name);
         try {
           return static_cast<T>(detail::evaluate_expression(expression, variable_map));
@@ -186,19 +195,11 @@ struct BlockInfo
         }
     }
 
-	template< class T>
-	std::vector<T> eval_param_vector(const std::string &param_name, const std::vector<BlockInfo> &variables) const
+	/*!
+	 * Splits a vector parameter, e.g. "(1, 2*a, 3)", into the expressions of its elements.
+	 */
+	std::vector<std::string> param_vector_elements(const std::string &param_name) const
 	{
-	    std::vector<T> result;
-
-	    std::map<std::string, double> variable_map;
-
-        for (auto &var : variables)
-        {
-            if(var.is_param_set("value"))
-                variable_map[var.id] = var.param_value<double>("value");
-        }
-
         auto expression = param_value(param_name);
 
         // get rid of spaces
@@ -220,6 +221,18 @@ struct BlockInfo
         boost::algorithm::split(parts, expression,
                 [] (char c) {return c == ',';});
 
+        return parts;
+    }
+
+	template< class T>
+	std::vector<T> eval_param_vector(const std::string &param_name, const std::vector<BlockInfo> &variables) const
+	{
+	    std::vector<T> result;
+
+	    auto variable_map = variable_values(variables);
+	    auto expression = param_value(param_name);
+	    auto parts = param_vector_elements(param_name);
+
         try {
             for (auto &p : parts) {
                 result.push_back(
@@ -235,13 +248,9 @@ struct BlockInfo
         return result;
     }
 
-  int eval_param_enum(const std::string &param_name) const
+  static std::map<std::string, gr::filter::firdes::win_type> window_types()
   {
-    auto expression = param_value(param_name);
-    auto enum_type = expression.substr(0, expression.find('.'));
-    auto enum_spec = expression.substr(expression.find('.')+1, expression.length());
-    if(enum_type == "firdes") {
-      std::map<std::string, gr::filter::firdes::win_type> enum_map = {
+      return {
         {"WIN_NONE", gr::filter::firdes::win_type::WIN_NONE},
         {"WIN_HAMMING", gr::filter::firdes::win_type::WIN_HAMMING},
         {"WIN_HANN", gr::filter::firdes::win_type::WIN_HANN},
@@ -252,6 +261,15 @@ struct BlockInfo
         {"WIN_BLACKMAN_HARRIS", gr::filter::firdes::win_type::WIN_BLACKMAN_HARRIS},
         {"WIN_BARTLETT", gr::filter::firdes::win_type::WIN_BARTLETT},
         {"WIN_FLATTOP", gr::filter::firdes::win_type::WIN_FLATTOP}};
+  }
+
+  int eval_param_enum(const std::string &param_name) const
+  {
+    auto expression = param_value(param_name);
+    auto enum_type = expression.substr(0, expression.find('.'));
+    auto enum_spec = expression.substr(expression.find('.')+1, expression.length());
+    if(enum_type == "firdes") {
+        auto enum_map = window_types();
         return enum_map[enum_spec];
     }
 
@@ -277,6 +295,157 @@ struct ConnectionInfo
 
 std::ostream& operator<<(std::ostream& os, const ConnectionInfo& dt);
 
+/*!
+ * \brief Everything read from a GRC file which is needed to build a flowgraph.
+ */
+struct GraphInfo
+{
+    BlockInfo top_block;
+    std::vector<BlockInfo> variables;
+    std::vector<BlockInfo> blocks;
+    std::vector<ConnectionInfo> connections;
+};
+
+/*!
+ * \brief Estimates the sample rate at the outputs of each block.
+ *
+ * Rates originate at blocks with a samp_rate (or samples_per_second) parameter
+ * and are propagated along the connections, taking decimation, downsampling
+ * and stream/vector conversions into account. Blocks for which no rate can be
+ * derived are not part of the returned map.
+ */
+std::map<std::string, double> propagate_sample_rates(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables);
+
+/*!
+ * \brief Latency class ("low" or "throughput") of each block.
+ *
+ * Blocks take the class given by their latency_class parameter. Interlock
+ * generation is low latency by default. A block without a class becomes low
+ * latency if all the blocks it feeds are, so that the class spreads upstream
+ * along latency critical paths, but not into branches shared with other paths.
+ * All remaining blocks are in the throughput class. The second member of the
+ * returned pairs is true if the class was inherited from the consumers.
+ */
+std::map<std::string, std::pair<std::string, bool>> assign_latency_classes(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections);
+
+/*!
+ * \brief Parses a list of CPUs, e.g. "2", "[0, 1]", "(0,1)" or "0-3,8".
+ *
+ * Python lists and tuples as stored by GRC and the range syntax of sysfs and
+ * taskset are accepted. An empty string gives an empty list.
+ */
+std::vector<int> parse_cpu_list(const std::string &value);
+
+/*!
+ * \brief Parses a block thread priority: "fifo:N", "rr:N", "nice:N" or a plain
+ * number N, meaning SCHED_FIFO with priority N.
+ */
+ThreadPriority parse_thread_priority(const std::string &value);
+
+/*!
+ * \brief Reads a CPU list file from sysfs, empty if it does not exist.
+ */
+std::vector<int> read_cpu_list(const std::string &path);
+
+/*!
+ * \brief CPUs available for pinning: the isolated CPUs if there are any,
+ * otherwise the online ones.
+ */
+std::vector<int> pinning_cpus();
+
+/*!
+ * \brief Groups the given CPUs by the last level cache they share.
+ */
+std::vector<std::vector<int>> cache_domains(const std::vector<int> &cpus);
+
+/*!
+ * \brief CPUs for each block without an affinity parameter under the given policy.
+ *
+ * Hierarchical blocks get all CPUs under the CHAIN and ROUND_ROBIN policies.
+ * Under SHARED_CACHE each group of connected blocks is assigned one cache domain.
+ */
+std::map<std::string, std::vector<int>> plan_affinity(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::set<std::string> &hierarchical,
+        PinningPolicy policy, const std::vector<int> &cpus, const std::vector<std::vector<int>> &domains);
+
+/*!
+ * \brief A NUMA node and its CPUs.
+ */
+struct NumaNode
+{
+    int node;
+    std::vector<int> cpus;
+};
+
+/*!
+ * \brief NUMA nodes with CPUs, a single node 0 if the system has no NUMA information.
+ */
+std::vector<NumaNode> numa_nodes();
+
+/*!
+ * \brief NUMA node of each block.
+ *
+ * Connected blocks stay on one node. A group containing a block with an explicit
+ * affinity goes to the node of that affinity, the other groups are spread over
+ * the nodes, balancing the load, i.e. the bytes per second the blocks produce.
+ */
+std::map<std::string, int> plan_numa_nodes(const std::vector<BlockInfo> &blocks,
+        const std::vector<ConnectionInfo> &connections, const std::map<std::string, double> &load,
+        const std::vector<NumaNode> &nodes);
+
+/*!
+ * \brief Number of load shedding steps until all annotated blocks are cut off.
+ */
+size_t load_shedding_steps(const std::map<std::string, int> &orders);
+
+/*!
+ * \brief Valve divisor of each block at the given load shedding step.
+ *
+ * Blocks are degraded in ascending shed_order, all blocks of one order together:
+ * their valves are open one cycle out of 2, then one out of 4, then not at all,
+ * divisor 0. Step 0 leaves all valves open, divisor 1.
+ */
+std::map<std::string, int> plan_load_shedding(const std::map<std::string, int> &orders, size_t step);
+
+/*!
+ * \brief Rounds a buffer size up so that it spans a whole number of pages.
+ */
+long round_to_pages(long nitems, size_t item_size, long page_size);
+
+/*!
+ * \brief Output buffer size in items planned by automatic buffer sizing.
+ *
+ * Holds target_latency seconds at the given rate but at least the items needed
+ * by the writer and readers, rounded up to whole pages.
+ */
+long planned_buffer_items(double samp_rate, double target_latency, long needed, size_t item_size, long page_size);
+
+/*!
+ * \brief Items GNU Radio 3.7 allocates for an output buffer, rounded to whole pages.
+ *
+ * \param needed items the writer and the readers need, two work calls of each
+ * including history
+ * \param minoutbuf, maxoutbuf output buffer setting of the writer, 0 if not set
+ */
+long allocated_buffer_items(long needed, size_t item_size, long minoutbuf, long maxoutbuf, long page_size);
+
+/*!
+ * \brief Drops disabled blocks and all connections from or to them.
+ */
+GraphInfo enabled_graph(const GraphInfo &graph);
+
+/*!
+ * \brief Estimates the memory needed by the (enabled) blocks of a graph.
+ */
+MemoryEstimate estimate_memory(const GraphInfo &graph, const BuildOptions &options);
+
+/*!
+ * \brief Checks a graph without making any block, see validate_flowgraph.
+ */
+std::vector<ValidationError> validate_graph(const GraphInfo &graph, const BuildOptions &options);
+
 class GrcParser
 {
 public:
@@ -348,6 +517,16 @@ public:
 		return d_top_block;
 	}
 
+	GraphInfo graph() const
+	{
+	    GraphInfo info;
+	    info.top_block = top_block();
+	    info.variables = d_variables;
+	    info.blocks = d_blocks;
+	    info.connections = d_connections;
+	    return info;
+	}
+
 private:
 	std::istream &d_is;
 	std::vector<BlockInfo> d_blocks;
@@ -357,11 +536,88 @@ private:
 	bool d_parsed;
 };
 
+/*!
+ * \brief How a block maker reads one of its parameters.
+ */
+enum class ParamKind
+{
+    TEXT,       // param_value<std::string>, optionally one of a set of choices
+    BOOL,       // param_value<bool>
+    INTEGER,    // param_value<int>, no expressions allowed
+    REAL,       // param_value<double>, no expressions allowed
+    EXPRESSION, // eval_param_value
+    VECTOR,     // eval_param_vector
+    WINDOW,     // eval_param_enum, a firdes window type
+    VARIABLE,   // id of a variable block, e.g. filter taps
+    CPU_LIST,   // parse_cpu_list
+    PRIORITY    // parse_thread_priority
+};
+
+struct ParamSpec
+{
+    ParamSpec(const std::string &name, ParamKind kind,
+            const std::vector<std::string> &choices = std::vector<std::string>()) :
+        name(name), kind(kind), choices(choices)
+    {
+    }
+
+    std::string name;
+    ParamKind kind;
+    std::vector<std::string> choices;
+};
+
+/*!
+ * \brief Item sizes of the input and output ports of a block.
+ *
+ * If open_inputs (open_outputs) is set any number of ports is accepted,
+ * all of them with the size of the last listed port.
+ */
+struct IoSizes
+{
+    IoSizes() : open_inputs(false), open_outputs(false) { }
+
+    std::vector<size_t> inputs;
+    std::vector<size_t> outputs;
+    bool open_inputs;
+    bool open_outputs;
+};
+
 // Needed to work around missing lambda support on some target platforms
 struct BlockMaker
 {
     static int getSizeOfType(std::string type);
     virtual gr::basic_block_sptr make(const BlockInfo &info, const std::vector<BlockInfo> &variables) = 0;
+
+    /*!
+     * \brief Parameters read by make, used to validate a block without making it.
+     */
+    virtual std::vector<ParamSpec> parameters(const BlockInfo &info) const
+    {
+        return std::vector<ParamSpec>();
+    }
+
+    /*!
+     * \brief Item sizes of the ports of the block which make would return.
+     *
+     * Returns false if they are only known once the block is made.
+     */
+    virtual bool io_sizes(const BlockInfo &info, const std::vector<BlockInfo> &variables, IoSizes &sizes) const
+    {
+        return false;
+    }
+
+    /*!
+     * \brief Whether the block keeps state worth carrying over a rebuild, e.g.
+     * averaging windows or filter histories.
+     *
+     * Such blocks are taken over unchanged by make_flowgraph from the previous
+     * flowgraph if their id and parameters did not change.
+     */
+    virtual bool transfer_state() const
+    {
+        return false;
+    }
+
     virtual ~BlockMaker() {}
 };
 
@@ -375,6 +631,20 @@ public:
 		return handlers_b.find(key) != handlers_b.end();
 	}
 
+	/*!
+	 * \brief Returns the maker for the given block type or a null pointer.
+	 */
+	boost::shared_ptr<BlockMaker> maker(const std::string &key) const
+	{
+		auto it = handlers_b.find(key);
+		return it != handlers_b.end() ? it->second : boost::shared_ptr<BlockMaker>();
+	}
+
+	/*!
+	 * \brief Parameters read by common_settings, if set.
+	 */
+	static std::vector<ParamSpec> common_parameters(const BlockInfo &info);
+
 	/*!
 	 * \brief Apply setting common to all block types.
 	 *
@@ -388,6 +658,134 @@ private:
 	std::map<std::string, boost::shared_ptr<BlockMaker>> handlers_b;
 };
 
+/*!
+ * \brief Turns the information read from a GRC file into a FlowGraph.
+ */
+class GraphBuilder
+{
+public:
+    GraphBuilder(const BuildOptions &options) : d_options(options) { }
+
+    /*!
+     * \brief Makes the flowgraph, taking over the stateful blocks of previous
+     * which did not change, see BlockMaker::transfer_state.
+     */
+    std::unique_ptr<FlowGraph> build(const GraphInfo &graph, FlowGraph *previous = nullptr);
+
+private:
+    /*!
+     * \brief Makes and connects the blocks of the enabled graph, using the adopted
+     * blocks instead of new ones. The per-block settings of the adopted blocks,
+     * e.g. affinity or buffer sizes, are applied again.
+     */
+    void populate(FlowGraph &graph, const GraphInfo &graph_info, const GraphInfo &enabled,
+            const std::map<std::string, gr::basic_block_sptr> &adopted);
+
+    /*!
+     * \brief Applies max_nouts and realtime_scheduling of the GRC options block.
+     */
+    void apply_options(FlowGraph &graph, const BlockInfo &top_block);
+
+    /*!
+     * \brief Places the blocks on NUMA nodes and pins them according to the pinning policy.
+     */
+    void apply_pinning(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+            const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables);
+
+    /*!
+     * \brief Applies chunk and buffer sizes according to the latency class of the blocks.
+     */
+    void apply_latency_classes(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+            const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables);
+
+    /*!
+     * \brief Sizes the output buffers of all blocks without explicit minoutbuf/maxoutbuf.
+     */
+    void plan_output_buffers(FlowGraph &graph, const std::vector<BlockInfo> &blocks,
+            const std::vector<ConnectionInfo> &connections, const std::vector<BlockInfo> &variables);
+
+    /*!
+     * \brief Items the writer and the readers of an output port need, two work calls
+     * of each including history.
+     */
+    static long needed_buffer_items(const FlowGraph &graph, const std::vector<ConnectionInfo> &connections,
+            const std::string &block_id, int port);
+
+    BuildOptions d_options;
+    BlockFactory d_factory;
+};
+
+/*!
+ * \brief Parameters of the GRC options block read by GraphBuilder, if set.
+ */
+std::vector<ParamSpec> options_parameters(const BlockInfo &top_block);
+
+/*!
+ * \brief Parameters of variable blocks read by the block makers, e.g. filter taps.
+ */
+std::vector<ParamSpec> variable_parameters(const BlockInfo &info);
+
+/*!
+ * \brief Replaces the expressions of the enabled blocks and variables by their values.
+ *
+ * Disabled blocks are dropped, see enabled_graph. Expressions which can't be
+ * evaluated are kept as they are, they fail once the block is made.
+ */
+GraphInfo fold_constants(const GraphInfo &graph);
+
+/*!
+ * \brief Key and parameters of a block, including the variables it references
+ * by name, e.g. filter taps. GRC only parameters, e.g. the position in the
+ * editor, are left out.
+ *
+ * Blocks with equal signatures are made the same way.
+ */
+std::string block_signature(const BlockInfo &info, const std::vector<BlockInfo> &variables);
+
+/*!
+ * \brief Converts a flowgraph compiled to C++ back to a GraphInfo.
+ */
+GraphInfo graph_info(const StaticGraph &graph);
+
+/*!
+ * \brief Plans buff_size, poll_rate and minoutbuf of digitizers in streaming mode.
+ *
+ * Only parameters set to "auto", "0" or left empty are planned, see DigitizerPlan:
+ * - poll_rate: half the target latency, between 1 ms and 100 ms
+ * - buff_size: four polling periods of samples, a power of two, at least 8192,
+ *   so that a late poll does not overflow the driver
+ * - minoutbuf: two driver buffers, so that the digitizer can hand over a full
+ *   driver buffer while the consumers still read the previous one
+ *
+ * Each enabled channel has a driver buffer and an output port of its own, the
+ * sizes are per channel and don't depend on the number of channels.
+ *
+ * Returns the graph with the planned values filled in. The plans are appended to
+ * plans, if given. Digitizers whose parameters can't be evaluated are left as
+ * they are, they are reported by validation or once the block is made.
+ */
+GraphInfo plan_digitizer_streaming(const GraphInfo &graph, double target_latency,
+        std::vector<DigitizerPlan> *plans);
+
+/*!
+ * \brief Applies a tuning overlay on top of a flowgraph.
+ *
+ * The overlay is an INI or JSON file. Each section selects blocks by id
+ * ("id:name" or just "name"), by type ("key:blocks_copy") or by a glob on the
+ * id ("glob:picoscope_*"), and sets or replaces their affinity, minoutbuf,
+ * maxoutbuf, max_noutput_items, priority, latency_class or shed_order
+ * parameters. The "options" section sets max_nouts, realtime_scheduling or
+ * scheduler of the options block. Sections selecting by key are applied first,
+ * then globs, then ids, so that the most specific selector wins. Unknown
+ * selectors or parameters throw std::invalid_argument.
+ */
+GraphInfo apply_overlay(const GraphInfo &graph, std::istream &overlay, bool json);
+
+/*!
+ * \brief Applies the overlay file, JSON if the name ends with .json, INI otherwise.
+ */
+GraphInfo apply_overlay_file(const GraphInfo &graph, const std::string &path);
+
 
 }
 
@@ -0,0 +1,331 @@
+/* -*- c++ -*- */
+/*
+ * Copyright (C) 2018 GSI Darmstadt, Germany - All Rights Reserved
+ *
+ * Co-developed with: Cosylab, Ljubljana, Slovenia and CERN, Geneva, Switzerland
+ * You may use, distribute and modify this code under the terms of the GPL v.3  license.
+ */
+
+#include <flowgraph/flowgraph_manager.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace flowgraph {
+
+static std::string read_file(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": can't open " << path;
+        throw std::runtime_error(message.str());
+    }
+
+    std::ostringstream content;
+    content << input.rdbuf();
+    return content.str();
+}
+
+FlowGraphManager::FlowGraphManager(const ManagerLimits &limits) :
+    d_limits(limits),
+    d_free_cpus(limits.cpus)
+{
+    if (d_limits.threads) {
+        set_thread_budget(d_limits.threads);
+    }
+}
+
+FlowGraphManager::~FlowGraphManager()
+{
+    for (auto &entry : d_graphs) {
+        try {
+            stop_graph(entry.second);
+        }
+        catch (const std::exception &e) {
+            std::cerr << "can't stop flowgraph " << entry.first << ": " << e.what() << "\n";
+        }
+    }
+}
+
+FlowGraphManager::ManagedGraph &FlowGraphManager::find(const std::string &name)
+{
+    auto it = d_graphs.find(name);
+    if (it == d_graphs.end()) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph " << name << " not found";
+        throw std::invalid_argument(message.str());
+    }
+    return it->second;
+}
+
+std::vector<int> FlowGraphManager::take_cpus(size_t count)
+{
+    if (count > d_free_cpus.size()) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": " << count << " CPUs requested, "
+                << d_free_cpus.size() << " of " << d_limits.cpus.size() << " are free";
+        throw std::runtime_error(message.str());
+    }
+
+    std::vector<int> cpus(d_free_cpus.begin(), d_free_cpus.begin() + count);
+    d_free_cpus.erase(d_free_cpus.begin(), d_free_cpus.begin() + count);
+    return cpus;
+}
+
+void FlowGraphManager::return_cpus(const std::vector<int> &cpus)
+{
+    d_free_cpus.insert(d_free_cpus.end(), cpus.begin(), cpus.end());
+    std::sort(d_free_cpus.begin(), d_free_cpus.end());
+}
+
+void FlowGraphManager::stop_graph(ManagedGraph &managed)
+{
+    if (managed.graph && managed.running) {
+        managed.graph->stop();
+        managed.graph->wait();
+    }
+    managed.running = false;
+}
+
+/*!
+ * Options the flowgraph is built with: the memory left by all other flowgraphs
+ * as memory budget and the CPUs handed out as pinning CPUs.
+ */
+static BuildOptions managed_options(const BuildOptions &requested, const std::vector<int> &cpus,
+        size_t memory_limit, size_t memory_used)
+{
+    BuildOptions options = requested;
+
+    if (memory_limit) {
+        size_t left = memory_limit > memory_used ? memory_limit - memory_used : 0;
+        if (!left) {
+            std::ostringstream message;
+            message << "Exception in " << __FILE__ << ":" << __LINE__ << ": the memory budget of "
+                    << memory_limit << " bytes is used up by the other flowgraphs";
+            throw std::runtime_error(message.str());
+        }
+        options.memory_budget = options.memory_budget ? std::min(options.memory_budget, left) : left;
+    }
+
+    if (!cpus.empty()) {
+        options.pinning_cpus = cpus;
+        if (options.pinning == PinningPolicy::NONE) {
+            options.pinning = PinningPolicy::CHAIN;
+        }
+    }
+
+    return options;
+}
+
+size_t FlowGraphManager::memory_used_by_others(const std::string &name) const
+{
+    size_t used = 0;
+    for (const auto &entry : d_graphs) {
+        if (entry.first != name && entry.second.graph) {
+            used += entry.second.graph->build_report().memory.total;
+        }
+    }
+    return used;
+}
+
+std::unique_ptr<FlowGraph> FlowGraphManager::build(const std::string &name, const ManagedGraph &managed,
+        const std::string &contents, FlowGraph *previous)
+{
+    auto options = managed_options(managed.options, managed.cpus, d_limits.memory, memory_used_by_others(name));
+    std::istringstream input(contents);
+    return previous ? make_flowgraph(input, options, *previous) : make_flowgraph(input, options);
+}
+
+void FlowGraphManager::add(const std::string &name, const std::string &path, const BuildOptions &options, size_t cpus)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    if (d_graphs.count(name)) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph " << name << " previously added!";
+        throw std::invalid_argument(message.str());
+    }
+
+    ManagedGraph managed;
+    managed.path = path;
+    managed.contents = read_file(path);
+    managed.options = options;
+    managed.cpus = take_cpus(cpus);
+    managed.running = false;
+    managed.reloads = 0;
+
+    try {
+        managed.graph = build(name, managed, managed.contents);
+    }
+    catch (...) {
+        return_cpus(managed.cpus);
+        throw;
+    }
+
+    d_graphs[name] = std::move(managed);
+}
+
+void FlowGraphManager::remove(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    auto &managed = find(name);
+    stop_graph(managed);
+    managed.graph.reset();
+    return_cpus(managed.cpus);
+    d_graphs.erase(name);
+}
+
+void FlowGraphManager::reload(const std::string &name, bool transfer_state)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    auto &managed = find(name);
+
+    // check the new file while the old flowgraph still runs, the same contents are built below
+    auto contents = read_file(managed.path);
+    auto options = managed_options(managed.options, managed.cpus, d_limits.memory, memory_used_by_others(name));
+    std::istringstream input(contents);
+    auto errors = validate_flowgraph(input, options);
+    if (!errors.empty()) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": can't reload flowgraph " << name << ": "
+                << (errors[0].block_id.empty() ? "" : errors[0].block_id + ": ") << errors[0].message;
+        throw std::invalid_argument(message.str());
+    }
+
+    // the blocks of the old flowgraph, e.g. digitizers, have to be released first
+    bool was_running = managed.running;
+    stop_graph(managed);
+    std::unique_ptr<FlowGraph> previous;
+    if (transfer_state) {
+        previous = std::move(managed.graph);
+    }
+    else {
+        managed.graph.reset();
+    }
+
+    try {
+        managed.graph = build(name, managed, contents, previous.get());
+    }
+    catch (...) {
+        // back to the last file, taking over the blocks handed back by the failed build
+        try {
+            managed.graph = build(name, managed, managed.contents, previous.get());
+            if (was_running) {
+                managed.graph->start();
+                managed.running = true;
+            }
+        }
+        catch (const std::exception &e) {
+            std::cerr << "can't restore flowgraph " << name << ": " << e.what() << "\n";
+        }
+        throw;
+    }
+    managed.contents = contents;
+    managed.reloads++;
+
+    if (was_running) {
+        managed.graph->start();
+        managed.running = true;
+    }
+}
+
+void FlowGraphManager::start(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    auto &managed = find(name);
+    if (!managed.graph) {
+        std::ostringstream message;
+        message << "Exception in " << __FILE__ << ":" << __LINE__ << ": flowgraph " << name << " failed to reload";
+        throw std::runtime_error(message.str());
+    }
+    if (!managed.running) {
+        managed.graph->start();
+        managed.running = true;
+    }
+}
+
+void FlowGraphManager::stop(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+    stop_graph(find(name));
+}
+
+void FlowGraphManager::start_all()
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    for (auto &entry : d_graphs) {
+        auto &managed = entry.second;
+        if (managed.graph && !managed.running) {
+            managed.graph->start();
+            managed.running = true;
+        }
+    }
+}
+
+void FlowGraphManager::stop_all()
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    for (auto &entry : d_graphs) {
+        stop_graph(entry.second);
+    }
+}
+
+FlowGraph *FlowGraphManager::graph(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+    return find(name).graph.get();
+}
+
+std::vector<std::string> FlowGraphManager::names() const
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    std::vector<std::string> names;
+    for (const auto &entry : d_graphs) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+ManagerMetrics FlowGraphManager::metrics() const
+{
+    std::lock_guard<std::mutex> lock(d_mutex);
+
+    ManagerMetrics metrics;
+    for (const auto &entry : d_graphs) {
+        const auto &managed = entry.second;
+
+        ManagedGraphMetrics graph;
+        graph.name = entry.first;
+        graph.path = managed.path;
+        graph.running = managed.running;
+        graph.cpus = managed.cpus;
+        graph.reloads = managed.reloads;
+        if (managed.graph) {
+            graph.threads = managed.graph->build_report().threads;
+            graph.memory = managed.graph->build_report().memory.total;
+        }
+
+        metrics.running += graph.running ? 1 : 0;
+        metrics.threads += graph.threads;
+        metrics.memory += graph.memory;
+        metrics.graphs.push_back(graph);
+    }
+
+    metrics.process_threads = scheduler_threads();
+    metrics.thread_budget = thread_budget();
+    metrics.memory_budget = d_limits.memory;
+    metrics.free_cpus = d_free_cpus;
+    return metrics;
+}
+
+}
@@ -36,6 +36,16 @@ void qa_parser::testOptions()
   CPPUNIT_ASSERT_EQUAL(std::string("options"), block.key);
   CPPUNIT_ASSERT_EQUAL(std::string("dial_tone"), block.id);
   CPPUNIT_ASSERT_EQUAL(std::string("Dial Tone"), block.param_value("title"));
+
+  // max_nouts, realtime_scheduling and scheduler are only applied if set
+  CPPUNIT_ASSERT(options_parameters(block).empty());
+  block.params["max_nouts"] = "1024";
+  block.params["realtime_scheduling"] = "1";
+  block.params["scheduler"] = "STS";
+  auto params = options_parameters(block);
+  CPPUNIT_ASSERT_EQUAL(3, (int)params.size());
+  CPPUNIT_ASSERT_EQUAL(2, (int)params[2].choices.size());
+  CPPUNIT_ASSERT_EQUAL(100000000, BuildReport().max_noutput_items);
 }
 
 void qa_parser::testCollapseVariables()
@@ -121,4 +131,469 @@ void qa_parser::testEvaluateExpressions()
   CPPUNIT_ASSERT_EQUAL(5000, (int)blocks[0].eval_param_value<float>("samp_rate", parser.variables()));
 }
 
+void qa_parser::testSampleRates()
+{
+  std::ifstream input("lib/test_sample_rates.grc");
+
+  GrcParser parser(input);
+  parser.parse();
+  parser.collapse_variables();
+
+  auto rates = propagate_sample_rates(parser.blocks(), parser.connections(), parser.variables());
+
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(1000000.0, rates["sig_source"], 1E-6);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(1000000.0, rates["throttle"], 1E-6);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(10000.0, rates["to_vector"], 1E-6);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(100000.0, rates["xlating"], 1E-6);
+
+  CPPUNIT_ASSERT_EQUAL(1024L, round_to_pages(1000, sizeof(float), 4096));
+  CPPUNIT_ASSERT_EQUAL(2048L, round_to_pages(1025, sizeof(float), 4096));
+  CPPUNIT_ASSERT_EQUAL(1024L, round_to_pages(1, 12, 4096));
+}
+
+void qa_parser::testBufferSetting()
+{
+  BuildOptions options;
+
+  // 10 MS/s of floats hold 10 ms in 100000 items, more than GNU Radio's default of 16384
+  auto high = planned_buffer_items(10e6, options.target_latency, 2, sizeof(float), 4096);
+  CPPUNIT_ASSERT_EQUAL(100352L, high);
+  auto raise = output_buffer_setting(high, sizeof(float));
+  CPPUNIT_ASSERT_EQUAL(high, raise.minoutbuf);
+  CPPUNIT_ASSERT_EQUAL(0L, raise.maxoutbuf);
+
+  // 10 kS/s only need 100 items, the default is capped
+  auto low = planned_buffer_items(10e3, options.target_latency, 2, sizeof(float), 4096);
+  CPPUNIT_ASSERT_EQUAL(1024L, low);
+  auto cap = output_buffer_setting(low, sizeof(float));
+  CPPUNIT_ASSERT_EQUAL(0L, cap.minoutbuf);
+  CPPUNIT_ASSERT_EQUAL(low, cap.maxoutbuf);
+
+  // a reader needing more than the latency is never capped below its need
+  CPPUNIT_ASSERT_EQUAL(4096L, planned_buffer_items(10e3, options.target_latency, 4000, sizeof(float), 4096));
+
+  // GNU Radio allocates exactly the plan with either setting
+  CPPUNIT_ASSERT_EQUAL(high, allocated_buffer_items(2, sizeof(float), raise.minoutbuf, raise.maxoutbuf, 4096));
+  CPPUNIT_ASSERT_EQUAL(low, allocated_buffer_items(2, sizeof(float), cap.minoutbuf, cap.maxoutbuf, 4096));
+  CPPUNIT_ASSERT_EQUAL(16384L, allocated_buffer_items(2, sizeof(float), 0, 0, 4096));
+}
+
+void qa_parser::testMemoryEstimate()
+{
+  std::ifstream input("lib/test_sample_rates.grc");
+
+  GrcParser parser(input);
+  parser.parse();
+  parser.collapse_variables();
+
+  auto graph = enabled_graph(parser.graph());
+  auto estimate = estimate_memory(graph, BuildOptions());
+
+  CPPUNIT_ASSERT_EQUAL(6, (int)estimate.blocks.size());
+  CPPUNIT_ASSERT_EQUAL(5, (int)estimate.edges.size());
+  CPPUNIT_ASSERT(estimate.total > 0);
+
+  for (const auto &edge : estimate.edges) {
+    if (edge.dst_id == "vector_sink") {
+      CPPUNIT_ASSERT_EQUAL(100 * sizeof(float), edge.item_size);
+    }
+    CPPUNIT_ASSERT(edge.buffer_bytes > 0);
+  }
+
+  // the budget is checked before any block is made
+  BuildOptions options;
+  options.memory_budget = 1024;
+  GraphBuilder builder(options);
+  CPPUNIT_ASSERT_THROW(builder.build(parser.graph()), std::runtime_error);
+}
+
+void qa_parser::testValidation()
+{
+  std::ifstream valid("lib/test_sample_rates.grc");
+  CPPUNIT_ASSERT(validate_flowgraph(valid).empty());
+
+  std::ifstream input("lib/test_validation.grc");
+  auto errors = validate_flowgraph(input);
+
+  std::map<std::string, int> errors_per_block;
+  for (const auto &error : errors) {
+    errors_per_block[error.block_id]++;
+  }
+
+  CPPUNIT_ASSERT_EQUAL(6, (int)errors.size());
+  CPPUNIT_ASSERT_EQUAL(1, errors_per_block["sink_float"]); // item size mismatch
+  CPPUNIT_ASSERT_EQUAL(2, errors_per_block["sig"]);        // expression and waveform
+  CPPUNIT_ASSERT_EQUAL(1, errors_per_block["throttle"]);   // output port 1
+  CPPUNIT_ASSERT_EQUAL(1, errors_per_block["to_vector"]);  // num_items missing
+  CPPUNIT_ASSERT_EQUAL(1, errors_per_block["unknown"]);    // block type
+  CPPUNIT_ASSERT_EQUAL(0, errors_per_block["disabled"]);
+
+  std::istringstream garbage("no flowgraph");
+  errors = validate_flowgraph(garbage);
+  CPPUNIT_ASSERT_EQUAL(1, (int)errors.size());
+  CPPUNIT_ASSERT(errors[0].block_id.empty());
+}
+
+void qa_parser::testTopology()
+{
+  // source -> throttle -> to_vector -> vector_sink
+  //                    -> xlating   -> xlating_sink
+  // source2 ---------------------------^ (port 1)
+  Topology topology;
+  Edge edges[] = {
+    {"source", 0, "throttle", 0, 4},
+    {"throttle", 0, "to_vector", 0, 4},
+    {"to_vector", 0, "vector_sink", 0, 400},
+    {"throttle", 0, "xlating", 0, 4},
+    {"xlating", 0, "xlating_sink", 0, 8},
+    {"source2", 0, "xlating_sink", 1, 8}
+  };
+  for (const auto &edge : edges) {
+    topology.add_edge(edge);
+  }
+
+  CPPUNIT_ASSERT_EQUAL(6, (int)topology.edges().size());
+  CPPUNIT_ASSERT_EQUAL(2, (int)topology.edges_from("throttle", 0).size());
+  CPPUNIT_ASSERT_EQUAL(0, (int)topology.edges_from("throttle", 1).size());
+  CPPUNIT_ASSERT_EQUAL((size_t)400, topology.edges_to("vector_sink")[0].item_size);
+
+  CPPUNIT_ASSERT_EQUAL(5, (int)topology.downstream("source").size());
+  CPPUNIT_ASSERT_EQUAL(2, (int)topology.sinks("source").size());
+  CPPUNIT_ASSERT_EQUAL(std::string("vector_sink"), topology.sinks("to_vector")[0]);
+
+  CPPUNIT_ASSERT_EQUAL(4, (int)topology.upstream("xlating_sink").size());
+  CPPUNIT_ASSERT_EQUAL(1, (int)topology.upstream("xlating_sink", 1).size());
+  CPPUNIT_ASSERT_EQUAL(2, (int)topology.sources("xlating_sink").size());
+  CPPUNIT_ASSERT_EQUAL(std::string("source"), topology.sources("vector_sink")[0]);
+
+  CPPUNIT_ASSERT(topology.downstream("unknown").empty());
+
+  // move the vector sink over to source2
+  Edge moved = {"source2", 0, "to_vector", 0, 4};
+  CPPUNIT_ASSERT(topology.remove_edge(edges[1]));
+  CPPUNIT_ASSERT(!topology.remove_edge(edges[1]));
+  topology.add_edge(moved);
+
+  CPPUNIT_ASSERT_EQUAL(6, (int)topology.edges().size());
+  CPPUNIT_ASSERT_EQUAL(1, (int)topology.edges_from("throttle").size());
+  CPPUNIT_ASSERT_EQUAL(std::string("source2"), topology.sources("vector_sink")[0]);
+  CPPUNIT_ASSERT_EQUAL(1, (int)topology.sinks("source").size());
+
+  // a block without edges is a sink again
+  CPPUNIT_ASSERT(topology.remove_edge(edges[4]));
+  CPPUNIT_ASSERT_EQUAL(std::string("xlating"), topology.sinks("source")[0]);
+}
+
+void qa_parser::testFoldConstants()
+{
+  std::ifstream input("lib/test_expressions.grc");
+
+  GrcParser parser(input);
+  parser.parse();
+  parser.collapse_variables();
+
+  auto folded = fold_constants(parser.graph());
+
+  CPPUNIT_ASSERT_EQUAL(1, (int)folded.blocks.size());
+  CPPUNIT_ASSERT_EQUAL(std::string("5000"), folded.blocks[0].param_value("samp_rate"));
+  CPPUNIT_ASSERT_EQUAL(std::string("analog.GR_COS_WAVE"), folded.blocks[0].param_value("waveform"));
+
+  // numbers are not passed to the expression parser
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(0.1, detail::evaluate_expression("0.1", {}), 1E-12);
+  CPPUNIT_ASSERT_DOUBLES_EQUAL(-1.0, detail::evaluate_expression("1-2", {}), 1E-12);
+
+  // the compiled form is built from the same parameters
+  StaticParam params[] = { {"_enabled", "True"}, {"samp_rate", "5000"} };
+  StaticBlock block = {"analog_sig_source_x", "sig_source", params, 2};
+  StaticConnection connection = {"sig_source", 0, "sink", 0};
+  StaticGraph graph = { {"options", "fold_test", nullptr, 0}, nullptr, 0, &block, 1, &connection, 1 };
+
+  auto info = graph_info(graph);
+  CPPUNIT_ASSERT_EQUAL(1, (int)info.blocks.size());
+  CPPUNIT_ASSERT_EQUAL(5000.0, info.blocks[0].eval_param_value<double>("samp_rate", info.variables));
+  CPPUNIT_ASSERT_EQUAL(std::string("sink"), info.connections[0].dst_id);
+}
+
+void qa_parser::testLatencyClasses()
+{
+  // source -> filter -> interlock -> sink
+  //        -> spectrum (port 1)
+  // source2 -> hold (throughput) -> interlock2
+  BlockInfo source{"digitizers_picoscope_3000a", "source", {}};
+  BlockInfo filter{"blocks_copy", "filter", {}};
+  BlockInfo interlock{interlock_generation_ff_key, "interlock", {}};
+  BlockInfo sink{"blocks_null_sink", "sink", {{"latency_class", "low"}}};
+  BlockInfo spectrum{"blocks_null_sink", "spectrum", {}};
+  BlockInfo source2{"analog_sig_source_x", "source2", {}};
+  BlockInfo hold{"blocks_copy", "hold", {{"latency_class", "throughput"}}};
+  BlockInfo interlock2{interlock_generation_ff_key, "interlock2", {}};
+  std::vector<BlockInfo> blocks = {source, filter, interlock, sink, spectrum, source2, hold, interlock2};
+
+  std::vector<ConnectionInfo> connections = {
+    {"source", "filter", 0, 0},
+    {"filter", "interlock", 0, 0},
+    {"interlock", "sink", 0, 0},
+    {"source", "spectrum", 1, 0},
+    {"source2", "hold", 0, 0},
+    {"hold", "interlock2", 0, 0}
+  };
+
+  auto classes = assign_latency_classes(blocks, connections);
+  CPPUNIT_ASSERT_EQUAL(std::string("low"), classes["interlock"].first);
+  CPPUNIT_ASSERT(!classes["interlock"].second);
+  CPPUNIT_ASSERT_EQUAL(std::string("low"), classes["filter"].first);
+  CPPUNIT_ASSERT(classes["filter"].second);
+  // shared with the spectrum path
+  CPPUNIT_ASSERT_EQUAL(std::string("throughput"), classes["source"].first);
+  CPPUNIT_ASSERT_EQUAL(std::string("throughput"), classes["spectrum"].first);
+  // explicit throughput stops the propagation
+  CPPUNIT_ASSERT_EQUAL(std::string("throughput"), classes["hold"].first);
+  CPPUNIT_ASSERT(!classes["hold"].second);
+  CPPUNIT_ASSERT_EQUAL(std::string("throughput"), classes["source2"].first);
+}
+
+void qa_parser::testAffinity()
+{
+  CPPUNIT_ASSERT(parse_cpu_list("").empty());
+  CPPUNIT_ASSERT(parse_cpu_list("[2]") == std::vector<int>({2}));
+  CPPUNIT_ASSERT(parse_cpu_list("(0, 1)") == std::vector<int>({0, 1}));
+  CPPUNIT_ASSERT(parse_cpu_list("0-2,8") == std::vector<int>({0, 1, 2, 8}));
+  CPPUNIT_ASSERT_THROW(parse_cpu_list("[a, b]"), std::invalid_argument);
+  CPPUNIT_ASSERT_THROW(parse_cpu_list("3-1"), std::invalid_argument);
+
+  // source -> filter -> sink, source2 -> cascade, pinned -> sink2
+  std::vector<BlockInfo> blocks = {
+    {"blocks_null_sink", "sink", {}},
+    {"blocks_copy", "filter", {}},
+    {"analog_sig_source_x", "source", {}},
+    {"analog_sig_source_x", "source2", {}},
+    {"digitizers_cascade_sink", "cascade", {}},
+    {"analog_sig_source_x", "pinned", {{"affinity", "[7]"}}},
+    {"blocks_null_sink", "sink2", {}}
+  };
+  std::vector<ConnectionInfo> connections = {
+    {"source", "filter", 0, 0},
+    {"filter", "sink", 0, 0},
+    {"source2", "cascade", 0, 0},
+    {"pinned", "sink2", 0, 0}
+  };
+  std::set<std::string> hierarchical = {"cascade"};
+  std::vector<int> cpus = {4, 5, 6};
+
+  auto chain = plan_affinity(blocks, connections, hierarchical, PinningPolicy::CHAIN, cpus, {});
+  CPPUNIT_ASSERT(chain["source"] == std::vector<int>({4}));
+  CPPUNIT_ASSERT(chain["filter"] == std::vector<int>({5}));
+  CPPUNIT_ASSERT(chain["sink"] == std::vector<int>({6}));
+  CPPUNIT_ASSERT(chain["source2"] == std::vector<int>({4}));
+  CPPUNIT_ASSERT(chain["cascade"] == cpus);
+  CPPUNIT_ASSERT(!chain.count("pinned"));
+
+  auto round_robin = plan_affinity(blocks, connections, hierarchical, PinningPolicy::ROUND_ROBIN, cpus, {});
+  CPPUNIT_ASSERT(round_robin["sink"] == std::vector<int>({4}));
+  CPPUNIT_ASSERT(round_robin["source"] == std::vector<int>({6}));
+
+  std::vector<std::vector<int>> domains = {{4, 5}, {6}};
+  auto shared = plan_affinity(blocks, connections, hierarchical, PinningPolicy::SHARED_CACHE, cpus, domains);
+  CPPUNIT_ASSERT(shared["source"] == domains[0]);
+  CPPUNIT_ASSERT(shared["filter"] == domains[0]);
+  CPPUNIT_ASSERT(shared["cascade"] == domains[1]);
+  CPPUNIT_ASSERT(shared["sink2"] == domains[0]);
+
+  CPPUNIT_ASSERT(plan_affinity(blocks, connections, hierarchical, PinningPolicy::NONE, cpus, {}).empty());
+}
+
+void qa_parser::testNumaPlacement()
+{
+  // digitizer (pinned to node 1) -> filter -> sink, source -> sink2, source2 -> sink3
+  std::vector<BlockInfo> blocks = {
+    {"digitizers_picoscope_3000a", "digitizer", {{"affinity", "[5]"}}},
+    {"blocks_copy", "filter", {}},
+    {"blocks_null_sink", "sink", {}},
+    {"analog_sig_source_x", "source", {}},
+    {"blocks_null_sink", "sink2", {}},
+    {"analog_sig_source_x", "source2", {}},
+    {"blocks_null_sink", "sink3", {}}
+  };
+  std::vector<ConnectionInfo> connections = {
+    {"digitizer", "filter", 0, 0},
+    {"filter", "sink", 0, 0},
+    {"source", "sink2", 0, 0},
+    {"source2", "sink3", 0, 0}
+  };
+  std::map<std::string, double> load = {{"digitizer", 4e8}, {"filter", 4e8}, {"source", 1e6}, {"source2", 2e6}};
+  std::vector<NumaNode> nodes = {{0, {0, 1, 2, 3}}, {1, {4, 5, 6, 7}}};
+
+  auto placement = plan_numa_nodes(blocks, connections, load, nodes);
+  CPPUNIT_ASSERT_EQUAL(1, placement["digitizer"]);
+  CPPUNIT_ASSERT_EQUAL(1, placement["sink"]);
+  CPPUNIT_ASSERT_EQUAL(0, placement["source2"]);
+  CPPUNIT_ASSERT_EQUAL(0, placement["sink2"]);
+
+  // single node machines put everything on the one node
+  auto single = plan_numa_nodes(blocks, connections, load, {{0, {0, 1}}});
+  CPPUNIT_ASSERT_EQUAL(0, single["digitizer"]);
+  CPPUNIT_ASSERT(!numa_nodes().empty());
+}
+
+void qa_parser::testThreadPriority()
+{
+  auto fifo = parse_thread_priority("80");
+  CPPUNIT_ASSERT_EQUAL((int)ThreadPriority::FIFO, (int)fifo.policy);
+  CPPUNIT_ASSERT_EQUAL(80, fifo.value);
+
+  auto rr = parse_thread_priority("RR: 10");
+  CPPUNIT_ASSERT_EQUAL((int)ThreadPriority::RR, (int)rr.policy);
+  CPPUNIT_ASSERT_EQUAL(10, rr.value);
+
+  auto nice = parse_thread_priority("nice:-5");
+  CPPUNIT_ASSERT_EQUAL((int)ThreadPriority::NICE, (int)nice.policy);
+  CPPUNIT_ASSERT_EQUAL(-5, nice.value);
+
+  CPPUNIT_ASSERT_THROW(parse_thread_priority("idle:1"), std::invalid_argument);
+  CPPUNIT_ASSERT_THROW(parse_thread_priority("fifo:high"), std::invalid_argument);
+}
+
+void qa_parser::testOverlay()
+{
+  GraphInfo graph;
+  graph.top_block = BlockInfo{"options", "top", {}};
+  graph.blocks = {
+    {"digitizers_picoscope_3000a", "picoscope", {{"affinity", ""}}},
+    {"digitizers_freq_sink_f", "freq_sink_0", {}},
+    {"digitizers_freq_sink_f", "freq_sink_1", {}},
+  };
+
+  std::istringstream ini(
+    "[options]\n"
+    "scheduler = STS\n"
+    "[freq_sink_1]\n"
+    "max_noutput_items = 1024\n"
+    "[glob:freq_sink_*]\n"
+    "max_noutput_items = 65536\n"
+    "[key:digitizers_picoscope_3000a]\n"
+    "affinity = 0-1\n"
+    "priority = fifo:50\n");
+  auto tuned = apply_overlay(graph, ini, false);
+
+  CPPUNIT_ASSERT_EQUAL(std::string("STS"), tuned.top_block.param_value("scheduler"));
+  CPPUNIT_ASSERT_EQUAL(std::string("0-1"), tuned.blocks[0].param_value("affinity"));
+  CPPUNIT_ASSERT_EQUAL(std::string("fifo:50"), tuned.blocks[0].param_value("priority"));
+  CPPUNIT_ASSERT_EQUAL(65536, tuned.blocks[1].param_value<int>("max_noutput_items"));
+  // the id selector wins over the glob
+  CPPUNIT_ASSERT_EQUAL(1024, tuned.blocks[2].param_value<int>("max_noutput_items"));
+
+  std::istringstream json("{\"id:picoscope\": {\"affinity\": [2, 3]}}");
+  tuned = apply_overlay(graph, json, true);
+  CPPUNIT_ASSERT(parse_cpu_list(tuned.blocks[0].param_value("affinity")) == std::vector<int>({2, 3}));
+
+  std::istringstream unsupported("[picoscope]\nsamp_rate = 1\n");
+  CPPUNIT_ASSERT_THROW(apply_overlay(graph, unsupported, false), std::invalid_argument);
+  std::istringstream selector("[type:picoscope]\naffinity = 1\n");
+  CPPUNIT_ASSERT_THROW(apply_overlay(graph, selector, false), std::invalid_argument);
+}
+
+void qa_parser::testDigitizerPlan()
+{
+  GraphInfo graph;
+  graph.variables = { {"variable", "samp_rate", {{"value", "10e6"}}} };
+  BlockInfo picoscope{picoscope_3000a_key, "picoscope", {
+    {"acquisition_mode", "Streaming"}, {"samp_rate", "samp_rate"},
+    {"downsampling_mode", "0"}, {"downsampling_factor", "1"},
+    {"enable_ai_a", "True"}, {"enable_ai_b", "False"},
+    {"buff_size", "auto"}, {"poll_rate", "0.001"}, {"minoutbuf", "0"}
+  }};
+  graph.blocks = {picoscope};
+
+  std::vector<DigitizerPlan> plans;
+  auto planned = plan_digitizer_streaming(graph, 0.01, &plans);
+  CPPUNIT_ASSERT_EQUAL(1, (int)plans.size());
+  CPPUNIT_ASSERT_EQUAL(1, plans[0].channels);
+  // four polls of 10000 samples
+  CPPUNIT_ASSERT_EQUAL(65536, plans[0].buff_size);
+  CPPUNIT_ASSERT(plans[0].buff_size_planned && !plans[0].poll_rate_planned && plans[0].minoutbuf_planned);
+  CPPUNIT_ASSERT_EQUAL(131072, planned.blocks[0].param_value<int>("minoutbuf"));
+  CPPUNIT_ASSERT_EQUAL(65536, planned.blocks[0].param_value<int>("buff_size"));
+
+  // explicit values win, nothing to plan
+  graph.blocks[0].params["buff_size"] = "8192";
+  plans.clear();
+  planned = plan_digitizer_streaming(graph, 0.01, &plans);
+  CPPUNIT_ASSERT(plans.empty());
+  CPPUNIT_ASSERT_EQUAL(8192, planned.blocks[0].param_value<int>("buff_size"));
+
+  // downsampled by 10, polling at half the target latency: four polls of 5000 samples
+  graph.blocks[0].params["buff_size"] = "auto";
+  graph.blocks[0].params["poll_rate"] = "auto";
+  graph.blocks[0].params["downsampling_mode"] = "1";
+  graph.blocks[0].params["downsampling_factor"] = "10";
+  planned = plan_digitizer_streaming(graph, 0.01, &plans);
+  CPPUNIT_ASSERT_EQUAL(1, (int)plans.size());
+  CPPUNIT_ASSERT_EQUAL(1e6, plans[0].output_rate);
+  CPPUNIT_ASSERT_EQUAL(0.005, plans[0].poll_rate);
+  CPPUNIT_ASSERT_EQUAL(32768, plans[0].buff_size);
+  CPPUNIT_ASSERT_EQUAL(65536, planned.blocks[0].param_value<int>("minoutbuf"));
+
+  // every channel has a driver buffer and an output port of its own
+  graph.blocks[0].params["enable_ai_b"] = "True";
+  plans.clear();
+  planned = plan_digitizer_streaming(graph, 0.01, &plans);
+  CPPUNIT_ASSERT_EQUAL(2, plans[0].channels);
+  CPPUNIT_ASSERT_EQUAL(32768, plans[0].buff_size);
+}
+
+void qa_parser::testBlockSignature()
+{
+  BlockInfo taps{"variable_low_pass_filter_taps", "taps", {{"cutoff_freq", "1000"}, {"_coordinate", "(10, 10)"}}};
+  BlockInfo filter{"freq_xlating_fir_filter_xxx", "filter",
+      {{"taps", "taps"}, {"decim", "4"}, {"_coordinate", "(100, 10)"}, {"comment", ""}}};
+  std::vector<BlockInfo> variables = {taps};
+
+  auto signature = block_signature(filter, variables);
+
+  // moving the block in the editor keeps the block
+  auto moved = filter;
+  moved.params["_coordinate"] = "(200, 50)";
+  moved.params["comment"] = "moved";
+  CPPUNIT_ASSERT_EQUAL(signature, block_signature(moved, variables));
+
+  auto decimated = filter;
+  decimated.params["decim"] = "8";
+  CPPUNIT_ASSERT(signature != block_signature(decimated, variables));
+
+  // changed taps change the filter referencing them
+  auto narrow = taps;
+  narrow.params["cutoff_freq"] = "500";
+  CPPUNIT_ASSERT(signature != block_signature(filter, {narrow}));
+
+  auto other_type = filter;
+  other_type.key = "blocks_copy";
+  CPPUNIT_ASSERT(signature != block_signature(other_type, variables));
+}
+
+void qa_parser::testLoadShedding()
+{
+  // the display sinks go first, the spectrum after them
+  std::map<std::string, int> orders = {{"freq_sink", 1}, {"time_sink", 1}, {"stft", 2}};
+  CPPUNIT_ASSERT_EQUAL((size_t)6, load_shedding_steps(orders));
+
+  auto none = plan_load_shedding(orders, 0);
+  CPPUNIT_ASSERT_EQUAL(1, none["freq_sink"]);
+  CPPUNIT_ASSERT_EQUAL(1, none["stft"]);
+
+  auto half = plan_load_shedding(orders, 1);
+  CPPUNIT_ASSERT_EQUAL(2, half["freq_sink"]);
+  CPPUNIT_ASSERT_EQUAL(2, half["time_sink"]);
+  CPPUNIT_ASSERT_EQUAL(1, half["stft"]);
+
+  auto sinks_closed = plan_load_shedding(orders, 4);
+  CPPUNIT_ASSERT_EQUAL(0, sinks_closed["freq_sink"]);
+  CPPUNIT_ASSERT_EQUAL(2, sinks_closed["stft"]);
+
+  auto all = plan_load_shedding(orders, 10);
+  CPPUNIT_ASSERT_EQUAL(0, all["time_sink"]);
+  CPPUNIT_ASSERT_EQUAL(0, all["stft"]);
+
+  CPPUNIT_ASSERT_EQUAL((size_t)0, load_shedding_steps({}));
+}
+
 }
@@ -24,6 +24,20 @@ public:
   CPPUNIT_TEST(testCollapseVariables);
   CPPUNIT_TEST(testExprtk);
   CPPUNIT_TEST(testEvaluateExpressions);
+  CPPUNIT_TEST(testSampleRates);
+  CPPUNIT_TEST(testBufferSetting);
+  CPPUNIT_TEST(testMemoryEstimate);
+  CPPUNIT_TEST(testValidation);
+  CPPUNIT_TEST(testTopology);
+  CPPUNIT_TEST(testFoldConstants);
+  CPPUNIT_TEST(testLatencyClasses);
+  CPPUNIT_TEST(testAffinity);
+  CPPUNIT_TEST(testNumaPlacement);
+  CPPUNIT_TEST(testThreadPriority);
+  CPPUNIT_TEST(testOverlay);
+  CPPUNIT_TEST(testDigitizerPlan);
+  CPPUNIT_TEST(testBlockSignature);
+  CPPUNIT_TEST(testLoadShedding);
   CPPUNIT_TEST_SUITE_END();
 private:
   void testGetVersion();
@@ -31,6 +45,20 @@ private:
   void testCollapseVariables();
   void testExprtk();
   void testEvaluateExpressions();
+  void testSampleRates();
+  void testBufferSetting();
+  void testMemoryEstimate();
+  void testValidation();
+  void testTopology();
+  void testFoldConstants();
+  void testLatencyClasses();
+  void testAffinity();
+  void testNumaPlacement();
+  void testThreadPriority();
+  void testOverlay();
+  void testDigitizerPlan();
+  void testBlockSignature();
+  void testLoadShedding();
 };
 
 